@@ -0,0 +1,100 @@
+#include "AllocationCounter.h"
+
+#include <cstdlib>
+#include <new>
+
+// замена глобальных operator new/delete со счетчиком выделений;
+// используется тестами и замерами, в библиотеку не входит
+
+namespace
+{
+  thread_local size_t allocations = 0;
+
+  void* allocate(const std::size_t i_size)
+  {
+    ++allocations;
+    if (void* p = std::malloc(i_size == 0 ? 1 : i_size))
+    {
+      return p;
+    }
+    throw std::bad_alloc();
+  }
+
+  void* allocate(const std::size_t i_size, const std::align_val_t i_alignment)
+  {
+    ++allocations;
+    const auto alignment = static_cast<std::size_t>(i_alignment);
+    // размер для aligned_alloc должен быть кратен выравниванию
+    const auto size = (i_size + alignment - 1) / alignment * alignment;
+    if (void* p = std::aligned_alloc(alignment, size == 0 ? alignment : size))
+    {
+      return p;
+    }
+    throw std::bad_alloc();
+  }
+}
+
+size_t allocationCount()
+{
+  return allocations;
+}
+
+void* operator new(const std::size_t i_size)
+{
+  return allocate(i_size);
+}
+
+void* operator new[](const std::size_t i_size)
+{
+  return allocate(i_size);
+}
+
+void* operator new(const std::size_t i_size, const std::align_val_t i_alignment)
+{
+  return allocate(i_size, i_alignment);
+}
+
+void* operator new[](const std::size_t i_size, const std::align_val_t i_alignment)
+{
+  return allocate(i_size, i_alignment);
+}
+
+void operator delete(void* i_p) noexcept
+{
+  std::free(i_p);
+}
+
+void operator delete[](void* i_p) noexcept
+{
+  std::free(i_p);
+}
+
+void operator delete(void* i_p, std::size_t) noexcept
+{
+  std::free(i_p);
+}
+
+void operator delete[](void* i_p, std::size_t) noexcept
+{
+  std::free(i_p);
+}
+
+void operator delete(void* i_p, std::align_val_t) noexcept
+{
+  std::free(i_p);
+}
+
+void operator delete[](void* i_p, std::align_val_t) noexcept
+{
+  std::free(i_p);
+}
+
+void operator delete(void* i_p, std::size_t, std::align_val_t) noexcept
+{
+  std::free(i_p);
+}
+
+void operator delete[](void* i_p, std::size_t, std::align_val_t) noexcept
+{
+  std::free(i_p);
+}
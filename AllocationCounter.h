@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+
+// число выделений памяти глобальным operator new в текущем потоке;
+// считается, только если в программу слинкован AllocationCounter.cpp
+size_t allocationCount();
+
+// число выделений памяти с момента создания объекта
+struct AllocationScope
+{
+  AllocationScope() : begin(allocationCount())
+  {
+  }
+
+  inline size_t count() const
+  {
+    return allocationCount() - begin;
+  }
+
+private:
+  size_t begin;
+};
@@ -49,9 +49,19 @@ struct ArrayView2
                                               d_size(i_array.size())
   {}
 
+  // в том числе std::pmr::vector
+  template<typename Allocator>
+  constexpr ArrayView2(const std::vector<T, Allocator>& i_array): d_array(i_array.data()),
+                                              d_size(i_array.size())
+  {}
+
   constexpr ArrayView2(): d_array(nullptr), d_size(0)
   {}
 
+  constexpr ArrayView2(const T* i_data, std::size_t i_size): d_array(i_data),
+                                              d_size(i_size)
+  {}
+
   constexpr std::size_t size() const
   {
     return d_size;
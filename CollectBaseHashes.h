@@ -3,6 +3,8 @@
 #include "TypeHash.h"
 
 #include <array>
+#include <cstdint>
+#include <string_view>
 #include <type_traits>
 
 // primary template handles types that have no nested ::Base member:
@@ -41,3 +43,56 @@ constexpr auto collect_base_hashes()
   return hashes;
 }
 
+
+// Проверка коллизий type_hash во время компиляции: перечисляет все типы
+// заданных иерархий событий (каждое событие и всю его цепочку ::Base), так что
+//   static_assert(has_unique_type_hashes(collect_type_hash_entries<E1, E2>()));
+// доказывает, что HB::isBaseOf не спутает два из них.
+struct type_hash_entry
+{
+  uint64_t hash;
+  std::string_view name;
+};
+
+template<typename T, typename A>
+constexpr void collect_type_hash_entries_int(A& entries, size_t& i)
+{
+  entries[i++] = type_hash_entry{type_hash<T>(), type_name<T>()};
+  if constexpr (has_base_member<T>::value)
+  {
+    collect_type_hash_entries_int<typename T::Base>(entries, i);
+  }
+}
+
+template<typename... Events>
+constexpr auto collect_type_hash_entries()
+{
+  std::array<type_hash_entry, (count_base_hashes<Events>() + ... + 0)> entries{};
+  size_t i = 0;
+  (collect_type_hash_entries_int<Events>(entries, i), ...);
+  return entries;
+}
+
+// одинаковые имена - один и тот же тип из разных цепочек, это не коллизия;
+// возвращает N, если коллизий нет
+template<size_t N>
+constexpr size_t find_type_hash_collision(const std::array<type_hash_entry, N>& entries)
+{
+  for (size_t i = 0; i < N; ++i)
+  {
+    for (size_t j = i + 1; j < N; ++j)
+    {
+      if (entries[i].hash == entries[j].hash && entries[i].name != entries[j].name)
+      {
+        return i;
+      }
+    }
+  }
+  return N;
+}
+
+template<size_t N>
+constexpr bool has_unique_type_hashes(const std::array<type_hash_entry, N>& entries)
+{
+  return find_type_hash_collision(entries) == N;
+}
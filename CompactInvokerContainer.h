@@ -0,0 +1,584 @@
+#pragma once
+
+#include "HashBasedEventDispatcher4.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace HB4
+{
+  // вариант InvokerContainer для десятков миллионов подписок: запись
+  // обработчика в массиве доставки - 8 байт (индекс функции и индекс слота
+  // объекта по 32 бита). Функции (thunk, methodId, поглощение) хранятся в
+  // таблице контейнера по одной на метод, указатели на объекты - в таблице
+  // слотов, освобожденные слоты используются повторно.
+  // Списки доставки не строятся и обработчики не копируются: invoke сливает
+  // массивы типов цепочки события по порядку подключения; номер подключения
+  // лежит в отдельном массиве и читается, только если уровней больше одного.
+  // Семантика connect/disconnect/invoke как у InvokerContainer, группы,
+  // приоритеты, ключи, фильтры и функторы не поддерживаются
+  template<typename TypeIds_ = AddressTypeIds>
+  struct BasicCompactInvokerContainer
+  {
+    using TypeIds = TypeIds_;
+
+    BasicCompactInvokerContainer()
+    {
+      // нулевая функция - отключенный обработчик
+      functions.push_back(CompactFunction{FunctionView(), MethodId(), false});
+    }
+
+    BasicCompactInvokerContainer(const BasicCompactInvokerContainer&) = delete;
+    BasicCompactInvokerContainer& operator=(const BasicCompactInvokerContainer&) = delete;
+
+    // возвращает true, если событие поглощено
+    template<typename Event>
+    bool invoke(const Event& event)
+    {
+      if constexpr (isCategoryEnabled<Event>())
+      {
+        return invoke(&event, typeInfo<Event, TypeIds>());
+      }
+      else
+      {
+        return false;
+      }
+    }
+
+    template<typename Root>
+    bool invokeDynamic(const Root& event)
+    {
+      static_assert(std::is_base_of_v<DynamicTypeInfo, Root>,
+                    "Root must be derived from HB4::Dispatchable");
+      static_assert(std::is_same_v<typename Root::DispatchTypeIds, TypeIds>,
+                    "Root and container must use the same TypeIds policy");
+      if constexpr (isCategoryEnabled<Root>())
+      {
+        return invoke(&event, event.getDynamicTypeInfo());
+      }
+      else
+      {
+        return false;
+      }
+    }
+
+    template<auto... Methods>
+    void connect(Class<Methods...>& i_object)
+    {
+      if constexpr ((isCategoryEnabled<Argument<Methods>>() || ...))
+      {
+        const auto object = acquireObject(&i_object);
+        const auto firstPos = pos;
+        try
+        {
+          (connectHandler<Methods>(object), ...);
+        }
+        catch (...)
+        {
+          // подключение откатывается целиком, как в FixedInvokerContainer;
+          // пустой слот объекта возвращается
+          removeIf(&i_object, [firstPos](const CompactFunction&,
+                                         const uint32_t i_position)
+          {
+            return i_position >= firstPos;
+          });
+          throw;
+        }
+      }
+    }
+
+    template<typename Object>
+    size_t disconnect(const Object& i_object)
+    {
+      return removeIf(&i_object, [](const CompactFunction&, uint32_t)
+      {
+        return true;
+      });
+    }
+
+    template<auto... Methods>
+    size_t disconnect(const Class<Methods...>& i_object)
+    {
+      const std::array<MethodId, sizeof...(Methods)> methodIds{
+              TypeIds::template methodId<Methods>()...};
+      return removeIf(&i_object, [&methodIds](const CompactFunction& function,
+                                              uint32_t)
+      {
+        return std::find(begin(methodIds), end(methodIds),
+                         function.methodId) != end(methodIds);
+      });
+    }
+
+    template<typename Event>
+    bool hasSubscribers() const
+    {
+      const auto eventType = typeInfo<Event, TypeIds>();
+      for (size_t i = 0; i < eventType.size(); ++i)
+      {
+        const auto found = eventTypeIndex.find(eventType[i]);
+        if (found != eventTypeIndex.end() &&
+            eventTypes[found->second].handlersCount > 0)
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    inline size_t getHandlersCount() const
+    {
+      size_t count = 0;
+      for (const auto& eventType: eventTypes)
+      {
+        count += eventType.handlersCount;
+      }
+      return count;
+    }
+
+    // байт в массивах, слотах и таблицах контейнера (узлы unordered_map -
+    // по оценке)
+    size_t getMemoryUsage() const
+    {
+      size_t bytes = functions.capacity() * sizeof(CompactFunction) +
+                     objects.capacity() * sizeof(void*) +
+                     objectInfos.capacity() * sizeof(ObjectInfo) +
+                     freeObjects.capacity() * sizeof(uint32_t) +
+                     eventTypes.capacity() * sizeof(CompactEventType) +
+                     getMapMemoryUsage(functionIndex) +
+                     getMapMemoryUsage(objectEventTypes) +
+                     getMapMemoryUsage(objectIndex) +
+                     getMapMemoryUsage(eventTypeIndex);
+      for (const auto& [object, types]: objectEventTypes)
+      {
+        bytes += types.capacity() * sizeof(uint32_t);
+      }
+      for (const auto& eventType: eventTypes)
+      {
+        bytes += eventType.handlers.capacity() * sizeof(CompactHandler) +
+                 eventType.positions.capacity() * sizeof(uint32_t);
+      }
+      return bytes;
+    }
+
+  private:
+    // запись в массиве доставки
+    struct CompactHandler
+    {
+      uint32_t function;
+      uint32_t object;
+    };
+
+    static_assert(sizeof(CompactHandler) == 8);
+
+    struct CompactFunction
+    {
+      FunctionView fv;
+      MethodId methodId;
+      bool consumes;
+    };
+
+    static constexpr uint32_t noEventType = std::numeric_limits<uint32_t>::max();
+    static constexpr uint32_t manyEventTypes = noEventType - 1;
+
+    // холодные данные слота объекта
+    struct ObjectInfo
+    {
+      uint32_t handlersCount = 0;
+      // индекс единственного типа событий объекта (для скрытия обработчиков
+      // базовых типов); manyEventTypes - список в objectEventTypes
+      uint32_t eventType = noEventType;
+    };
+
+    struct CompactEventType
+    {
+      // статическая цепочка typeInfo, от корня
+      ArrayView2<TypeId> typeInfo;
+      std::vector<CompactHandler> handlers;
+      // номер подключения для каждой записи handlers
+      std::vector<uint32_t> positions;
+      size_t handlersCount = 0;
+    };
+
+    // уровень цепочки события при слиянии
+    struct Level
+    {
+      uint32_t eventType;
+      size_t next;
+      size_t end;
+    };
+
+    static constexpr uint32_t maxIndex = manyEventTypes;
+    // глубина цепочки типа подписки: invoke сливает уровни в массиве на стеке
+    static constexpr size_t maxLevels = 16;
+
+    // массив корзин и узлы: значение, указатель на следующий узел и хэш
+    template<typename Map>
+    static size_t getMapMemoryUsage(const Map& i_map)
+    {
+      return i_map.bucket_count() * sizeof(void*) +
+             i_map.size() * (sizeof(typename Map::value_type) +
+                             sizeof(void*) + sizeof(size_t));
+    }
+
+    static inline uint32_t checkedIndex(const size_t i_index, const char* i_what)
+    {
+      if (i_index >= maxIndex)
+      {
+        throw std::length_error(i_what);
+      }
+      return static_cast<uint32_t>(i_index);
+    }
+
+    uint32_t acquireObject(const void* i_object)
+    {
+      const auto found = objectIndex.find(i_object);
+      if (found != objectIndex.end())
+      {
+        return found->second;
+      }
+      uint32_t slot;
+      if (!freeObjects.empty())
+      {
+        slot = freeObjects.back();
+        freeObjects.pop_back();
+        objects[slot] = const_cast<void*>(i_object);
+      }
+      else
+      {
+        slot = checkedIndex(objects.size(), "HB4: too many compact objects");
+        objects.push_back(const_cast<void*>(i_object));
+        objectInfos.emplace_back();
+      }
+      objectIndex.emplace(i_object, slot);
+      return slot;
+    }
+
+    // у объекта не осталось обработчиков
+    void releaseObject(
+            const typename std::unordered_map<const void*, uint32_t>::iterator i_found)
+    {
+      const auto object = i_found->second;
+      objectIndex.erase(i_found);
+      objects[object] = nullptr;
+      freeObjects.push_back(object);
+    }
+
+    template<auto Method>
+    uint32_t internFunction()
+    {
+      const auto methodId = TypeIds::template methodId<Method>();
+      const auto found = functionIndex.find(methodId);
+      if (found != functionIndex.end())
+      {
+        return found->second;
+      }
+      const auto function = checkedIndex(functions.size(),
+                                         "HB4: too many compact functions");
+      functions.push_back(CompactFunction{
+              FunctionView(TemplateParameter<Method>(), TypeIds()), methodId,
+              IsConsumingResult<Result<Method>>});
+      functionIndex.emplace(methodId, function);
+      return function;
+    }
+
+    uint32_t acquireEventType(const ArrayView2<TypeId> i_typeInfo)
+    {
+      const auto found = eventTypeIndex.find(i_typeInfo.back());
+      if (found != eventTypeIndex.end())
+      {
+        return found->second;
+      }
+      if (i_typeInfo.size() > maxLevels)
+      {
+        throw std::length_error("HB4: compact event type chain is too deep");
+      }
+      const auto index = checkedIndex(eventTypes.size(),
+                                      "HB4: too many compact event types");
+      eventTypes.emplace_back();
+      eventTypes.back().typeInfo = i_typeInfo;
+      eventTypeIndex.emplace(i_typeInfo.back(), index);
+      return index;
+    }
+
+    template<auto Method>
+    void connectHandler(const uint32_t i_object)
+    {
+      if constexpr (isCategoryEnabled<Argument<Method>>())
+      {
+        const auto eventType = acquireEventType(
+                typeInfo<Argument<Method>, TypeIds>());
+        const auto function = internFunction<Method>();
+        const auto position = checkedIndex(pos,
+                                           "HB4: too many compact connections");
+        auto& handlers = eventTypes[eventType];
+        handlers.handlers.push_back(CompactHandler{function, i_object});
+        handlers.positions.push_back(position);
+        ++pos;
+        ++handlers.handlersCount;
+        auto& info = objectInfos[i_object];
+        ++info.handlersCount;
+        if (info.eventType == noEventType)
+        {
+          info.eventType = eventType;
+        }
+        else if (info.eventType == manyEventTypes)
+        {
+          auto& types = objectEventTypes[i_object];
+          if (std::find(begin(types), end(types), eventType) == end(types))
+          {
+            types.push_back(eventType);
+          }
+        }
+        else if (info.eventType != eventType)
+        {
+          objectEventTypes[i_object] = {info.eventType, eventType};
+          info.eventType = manyEventTypes;
+        }
+      }
+    }
+
+    // объект подписан на тип цепочки события глубже i_depth
+    inline bool isHidden(const uint32_t i_object, const size_t i_depth,
+                         const ArrayView2<TypeId> i_eventType) const
+    {
+      for (const auto index: objectEventTypes.at(i_object))
+      {
+        const auto& typeInfo = eventTypes[index].typeInfo;
+        if (typeInfo.size() > i_depth && typeInfo.size() <= i_eventType.size() &&
+            i_eventType[typeInfo.size() - 1] == typeInfo.back())
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    // обработчики, подключенные во время доставки, в нее не попадают:
+    // границы массивов запоминаются до первого вызова
+    bool invoke(const void* i_event, const ArrayView2<TypeId> i_eventType)
+    {
+      // у подписанных типов цепочки разная глубина, не больше maxLevels
+      // (проверяется в acquireEventType), поэтому уровни помещаются в массив
+      std::array<Level, maxLevels> levels;
+      size_t levelsCount = 0;
+      for (size_t i = 0; i < i_eventType.size() && i < maxLevels; ++i)
+      {
+        const auto found = eventTypeIndex.find(i_eventType[i]);
+        if (found != eventTypeIndex.end())
+        {
+          levels[levelsCount++] = Level{
+                  found->second, 0, eventTypes[found->second].handlers.size()};
+        }
+      }
+      if (levelsCount == 0)
+      {
+        return false;
+      }
+      ++depth;
+      bool consumed = false;
+      if (levelsCount == 1)
+      {
+        // один уровень: номера подключений не нужны, скрывать обработчик
+        // нечем, выключенные записи вызывают FunctionView::skip
+        for (size_t i = 0; i < levels[0].end && !consumed; ++i)
+        {
+          consumed = call(eventTypes[levels[0].eventType].handlers[i], i_event);
+        }
+      }
+      else
+      {
+        while (!consumed)
+        {
+          Level* level = nullptr;
+          uint32_t levelPos = 0;
+          for (size_t i = 0; i < levelsCount; ++i)
+          {
+            auto& candidate = levels[i];
+            if (candidate.next < candidate.end)
+            {
+              const auto candidatePos =
+                      eventTypes[candidate.eventType].positions[candidate.next];
+              if (!level || candidatePos < levelPos)
+              {
+                level = &candidate;
+                levelPos = candidatePos;
+              }
+            }
+          }
+          if (!level)
+          {
+            break;
+          }
+          const auto& eventType = eventTypes[level->eventType];
+          const auto handler = eventType.handlers[level->next++];
+          if (handler.function != 0 &&
+              (eventType.typeInfo.size() == i_eventType.size() ||
+               objectInfos[handler.object].eventType != manyEventTypes ||
+               !isHidden(handler.object, eventType.typeInfo.size(), i_eventType)))
+          {
+            consumed = call(handler, i_event);
+          }
+        }
+      }
+      if (--depth == 0)
+      {
+        removeEmpty();
+      }
+      return consumed;
+    }
+
+    inline bool call(const CompactHandler i_handler, const void* i_event) const
+    {
+      const auto& function = functions[i_handler.function];
+      return function.fv.func(objects[i_handler.object], i_event, nullptr) &&
+             function.consumes;
+    }
+
+    // во время доставки записи только выключаются (нулевая функция);
+    // shouldRemove получает функцию и номер подключения записи
+    template<typename F>
+    size_t removeIf(const void* i_object, F shouldRemove)
+    {
+      const auto found = objectIndex.find(i_object);
+      if (found == objectIndex.end())
+      {
+        return 0;
+      }
+      const auto object = found->second;
+      auto& info = objectInfos[object];
+      size_t disconnected = 0;
+      // false - у объекта не осталось обработчиков этого типа
+      const auto removeFromEventType = [&](const uint32_t i_eventType)
+      {
+        auto& eventType = eventTypes[i_eventType];
+        bool remains = false;
+        for (size_t i = 0; i < eventType.handlers.size(); ++i)
+        {
+          auto& handler = eventType.handlers[i];
+          if (handler.object == object && handler.function != 0)
+          {
+            if (shouldRemove(functions[handler.function], eventType.positions[i]))
+            {
+              handler.function = 0;
+              --eventType.handlersCount;
+              ++disconnected;
+            }
+            else
+            {
+              remains = true;
+            }
+          }
+        }
+        return remains;
+      };
+      if (info.eventType == manyEventTypes)
+      {
+        const auto many = objectEventTypes.find(object);
+        auto& types = many->second;
+        types.erase(std::remove_if(begin(types), end(types),
+                                   [&](const uint32_t eventType)
+                                   {
+                                     return !removeFromEventType(eventType);
+                                   }), end(types));
+        if (types.size() < 2)
+        {
+          info.eventType = types.empty() ? noEventType : types.front();
+          objectEventTypes.erase(many);
+        }
+      }
+      else if (info.eventType != noEventType &&
+               !removeFromEventType(info.eventType))
+      {
+        info.eventType = noEventType;
+      }
+      info.handlersCount -= static_cast<uint32_t>(disconnected);
+      if (info.handlersCount == 0)
+      {
+        // выключенные записи слот не читают, его можно отдать сразу
+        releaseObject(found);
+      }
+      dirty = dirty || disconnected > 0;
+      if (depth == 0)
+      {
+        removeEmpty();
+      }
+      return disconnected;
+    }
+
+    void removeEmpty()
+    {
+      if (!dirty)
+      {
+        return;
+      }
+      for (auto& eventType: eventTypes)
+      {
+        if (eventType.handlersCount == eventType.handlers.size())
+        {
+          continue;
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < eventType.handlers.size(); ++i)
+        {
+          if (eventType.handlers[i].function != 0)
+          {
+            eventType.handlers[kept] = eventType.handlers[i];
+            eventType.positions[kept] = eventType.positions[i];
+            ++kept;
+          }
+        }
+        eventType.handlers.resize(kept);
+        eventType.positions.resize(kept);
+      }
+      dirty = false;
+      // номера подключений сжимаются до рангов, когда выданных номеров
+      // вдвое больше живых записей: счетчик не упирается в 32 бита
+      // при долгой работе с подключениями и отключениями
+      const auto handlersCount = getHandlersCount();
+      if (pos > 2 * handlersCount)
+      {
+        std::vector<uint32_t> sorted;
+        sorted.reserve(handlersCount);
+        for (const auto& eventType: eventTypes)
+        {
+          sorted.insert(end(sorted), begin(eventType.positions),
+                        end(eventType.positions));
+        }
+        std::sort(begin(sorted), end(sorted));
+        for (auto& eventType: eventTypes)
+        {
+          for (auto& position: eventType.positions)
+          {
+            position = static_cast<uint32_t>(
+                    std::lower_bound(begin(sorted), end(sorted), position) -
+                    begin(sorted));
+          }
+        }
+        pos = sorted.size();
+      }
+    }
+
+    std::vector<CompactFunction> functions;
+    std::unordered_map<MethodId, uint32_t> functionIndex;
+    // горячая часть слота - только указатель на объект
+    std::vector<void*> objects;
+    std::vector<ObjectInfo> objectInfos;
+    // типы событий объектов, подписанных больше чем на один тип
+    std::unordered_map<uint32_t, std::vector<uint32_t>> objectEventTypes;
+    std::vector<uint32_t> freeObjects;
+    std::unordered_map<const void*, uint32_t> objectIndex;
+    // пустые типы событий не удаляются: на их индексы ссылаются слоты
+    std::vector<CompactEventType> eventTypes;
+    std::unordered_map<TypeId, uint32_t> eventTypeIndex;
+    size_t pos = 0;
+    size_t depth = 0;
+    bool dirty = false;
+  };
+
+  using CompactInvokerContainer = BasicCompactInvokerContainer<>;
+}
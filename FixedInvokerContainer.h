@@ -0,0 +1,483 @@
+#pragma once
+
+#include "HashBasedEventDispatcher4.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+
+namespace HB4
+{
+  // результат connect контейнера с фиксированной емкостью
+  enum class FixedStatus
+  {
+    Ok,
+    // заняты все maxEventTypes типов событий
+    TooManyEventTypes,
+    // в массиве типа нет места (отключенные во время доставки обработчики
+    // занимают место до ее конца)
+    TooManyHandlers,
+    // у обработчика больше maxHiddenTypes скрывающих его типов
+    TooManyHiddenTypes
+  };
+
+  struct FixedInvokerContainerTraits
+  {
+    using TypeIds = AddressTypeIds;
+    // различных типов событий, на которые есть обработчики
+    static constexpr size_t maxEventTypes = 16;
+    // обработчиков одного типа события
+    static constexpr size_t maxHandlersPerType = 32;
+    // типов того же объекта, производных от типа обработчика (notProcessesEvents)
+    static constexpr size_t maxHiddenTypes = 4;
+  };
+
+  // вариант InvokerContainer без кучи для потоков реального времени:
+  // все таблицы - массивы внутри объекта, память не выделяется ни при
+  // connect/disconnect, ни при invoke. Списки доставки не строятся:
+  // invoke сливает массивы типов цепочки события по порядку подключения,
+  // время доставки ограничено емкостями и не зависит от истории подключений.
+  // Семантика connect/disconnect/invoke как у InvokerContainer: порядок
+  // подключения, скрытие обработчиков базовых типов того же объекта,
+  // поглощение события, отключение и подключение во время доставки.
+  // Группы, приоритеты, ключи, фильтры и функторы не поддерживаются
+  template<typename Traits = FixedInvokerContainerTraits>
+  struct BasicFixedInvokerContainer
+  {
+    using TypeIds = typename Traits::TypeIds;
+
+    BasicFixedInvokerContainer() = default;
+    BasicFixedInvokerContainer(const BasicFixedInvokerContainer&) = delete;
+    BasicFixedInvokerContainer& operator=(const BasicFixedInvokerContainer&) = delete;
+
+    // возвращает true, если событие поглощено
+    template<typename Event>
+    bool invoke(const Event& event)
+    {
+      if constexpr (isCategoryEnabled<Event>())
+      {
+        return invoke(&event, typeInfo<Event, TypeIds>());
+      }
+      else
+      {
+        return false;
+      }
+    }
+
+    template<typename Root>
+    bool invokeDynamic(const Root& event)
+    {
+      static_assert(std::is_base_of_v<DynamicTypeInfo, Root>,
+                    "Root must be derived from HB4::Dispatchable");
+      static_assert(std::is_same_v<typename Root::DispatchTypeIds, TypeIds>,
+                    "Root and container must use the same TypeIds policy");
+      if constexpr (isCategoryEnabled<Root>())
+      {
+        return invoke(&event, event.getDynamicTypeInfo());
+      }
+      else
+      {
+        return false;
+      }
+    }
+
+    // при ошибке ни один из методов не подключается
+    template<auto... Methods>
+    [[nodiscard]] FixedStatus connect(Class<Methods...>& i_object)
+    {
+      if constexpr (!(isCategoryEnabled<Argument<Methods>>() || ...))
+      {
+        return FixedStatus::Ok;
+      }
+      else
+      {
+        const std::array<ArrayView2<TypeId>, sizeof...(Methods)> eventTypes{
+                typeInfo<Argument<Methods>, TypeIds>()...};
+        const std::array<bool, sizeof...(Methods)> enabled{
+                isCategoryEnabled<Argument<Methods>>()...};
+        if (const auto status = checkCapacity(eventTypes, enabled);
+                status != FixedStatus::Ok)
+        {
+          return status;
+        }
+        const auto firstPos = pos;
+        (connectHandler<Methods>(i_object), ...);
+        if (!updateHiddenTypes(&i_object))
+        {
+          removeIf([&i_object, firstPos](const FixedHandler& handler)
+                   {
+                     return handler.fv.getObject() == &i_object &&
+                            handler.pos >= firstPos;
+                   });
+          return FixedStatus::TooManyHiddenTypes;
+        }
+        return FixedStatus::Ok;
+      }
+    }
+
+    template<typename Object>
+    size_t disconnect(const Object& i_object)
+    {
+      return removeIf([&i_object](const FixedHandler& handler)
+                      {
+                        return handler.fv.getObject() == &i_object;
+                      });
+    }
+
+    template<auto... Methods>
+    size_t disconnect(const Class<Methods...>& i_object)
+    {
+      const std::array<MethodId, sizeof...(Methods)> methodIds{
+              TypeIds::template methodId<Methods>()...};
+      const auto disconnected = removeIf(
+              [&i_object, &methodIds](const FixedHandler& handler)
+              {
+                return handler.fv.getObject() == &i_object &&
+                       std::find(begin(methodIds), end(methodIds),
+                                 handler.methodId) != end(methodIds);
+              });
+      // обработчики базовых типов больше не скрыты
+      // (скрывающих типов становится меньше, емкости хватает)
+      [[maybe_unused]] const auto updated = updateHiddenTypes(&i_object);
+      assert(updated);
+      return disconnected;
+    }
+
+    template<typename Event>
+    bool hasSubscribers() const
+    {
+      const auto eventType = typeInfo<Event, TypeIds>();
+      for (size_t i = 0; i < eventTypesCount; ++i)
+      {
+        const auto& slot = eventTypes[i];
+        if (isBaseOrEqual(slot.typeInfo, eventType) &&
+            std::any_of(begin(slot.handlers), begin(slot.handlers) + slot.count,
+                        [](const auto& handler)
+                        {
+                          return !handler.fv.isDisabled();
+                        }))
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+
+  private:
+    struct FixedHandler
+    {
+      ObjectFunctionView fv;
+      MethodId methodId{};
+      size_t pos = 0;
+      bool consumes = false;
+      size_t hiddenCount = 0;
+      std::array<ArrayView2<TypeId>, Traits::maxHiddenTypes> hiddenTypes;
+    };
+
+    struct FixedEventType
+    {
+      // статическая цепочка typeInfo, от корня
+      ArrayView2<TypeId> typeInfo;
+      size_t count = 0;
+      std::array<FixedHandler, Traits::maxHandlersPerType> handlers;
+    };
+
+    // уровень цепочки события при слиянии
+    struct Level
+    {
+      FixedEventType* eventType;
+      size_t next;
+      bool isOwnType;
+    };
+
+    static constexpr bool isBaseOrEqual(const ArrayView2<TypeId> i_base,
+                                        const ArrayView2<TypeId> i_derived)
+    {
+      return !i_base.empty() && i_derived.size() >= i_base.size() &&
+             i_derived[i_base.size() - 1] == i_base.back();
+    }
+
+    static constexpr bool isStrictBase(const ArrayView2<TypeId> i_base,
+                                       const ArrayView2<TypeId> i_derived)
+    {
+      return i_derived.size() > i_base.size() && isBaseOrEqual(i_base, i_derived);
+    }
+
+    static inline bool isHidden(const FixedHandler& i_handler,
+                                const ArrayView2<TypeId> i_eventType)
+    {
+      for (size_t i = 0; i < i_handler.hiddenCount; ++i)
+      {
+        if (isBaseOrEqual(i_handler.hiddenTypes[i], i_eventType))
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    inline FixedEventType* findEventType(const TypeId i_typeId)
+    {
+      for (size_t i = 0; i < eventTypesCount; ++i)
+      {
+        if (eventTypes[i].typeInfo.back() == i_typeId)
+        {
+          return &eventTypes[i];
+        }
+      }
+      return nullptr;
+    }
+
+    // O(уровни * (типы + обработчики)), без перестроений
+    bool invoke(const void* i_event, const ArrayView2<TypeId> i_eventType)
+    {
+      std::array<Level, Traits::maxEventTypes> levels;
+      size_t levelsCount = 0;
+      for (size_t i = 0; i < i_eventType.size() &&
+                         levelsCount < levels.size(); ++i)
+      {
+        if (auto* eventType = findEventType(i_eventType[i]))
+        {
+          levels[levelsCount++] = Level{eventType, 0,
+                                        i + 1 == i_eventType.size()};
+        }
+      }
+      // подключенные во время доставки обработчики в нее не попадают
+      const auto endPos = pos;
+      ++depth;
+      bool consumed = false;
+      while (!consumed)
+      {
+        // следующий по порядку подключения обработчик из всех уровней
+        Level* level = nullptr;
+        for (size_t i = 0; i < levelsCount; ++i)
+        {
+          auto& candidate = levels[i];
+          if (candidate.next < candidate.eventType->count &&
+              candidate.eventType->handlers[candidate.next].pos < endPos &&
+              (!level || candidate.eventType->handlers[candidate.next].pos <
+                         level->eventType->handlers[level->next].pos))
+          {
+            level = &candidate;
+          }
+        }
+        if (!level)
+        {
+          break;
+        }
+        const auto& handler = level->eventType->handlers[level->next++];
+        if (!handler.fv.isDisabled() &&
+            (level->isOwnType || !isHidden(handler, i_eventType)))
+        {
+          consumed = handler.fv.invoke(i_event, nullptr) && handler.consumes;
+        }
+      }
+      if (--depth == 0)
+      {
+        removeEmpty();
+      }
+      return consumed;
+    }
+
+    template<size_t N>
+    FixedStatus checkCapacity(const std::array<ArrayView2<TypeId>, N>& i_eventTypes,
+                              const std::array<bool, N>& i_enabled)
+    {
+      size_t newEventTypes = 0;
+      for (size_t i = 0; i < N; ++i)
+      {
+        if (!i_enabled[i])
+        {
+          continue;
+        }
+        size_t sameType = 0;
+        bool seen = false;
+        for (size_t j = 0; j < N; ++j)
+        {
+          if (i_enabled[j] && i_eventTypes[j].back() == i_eventTypes[i].back())
+          {
+            ++sameType;
+            seen = seen || j < i;
+          }
+        }
+        const auto* eventType = findEventType(i_eventTypes[i].back());
+        if (!eventType && !seen)
+        {
+          ++newEventTypes;
+        }
+        if ((eventType ? eventType->count : 0) + sameType >
+            Traits::maxHandlersPerType)
+        {
+          return FixedStatus::TooManyHandlers;
+        }
+      }
+      return eventTypesCount + newEventTypes > Traits::maxEventTypes ?
+             FixedStatus::TooManyEventTypes : FixedStatus::Ok;
+    }
+
+    template<auto Method>
+    inline void connectHandler(Class<Method>& i_object)
+    {
+      if constexpr (isCategoryEnabled<Argument<Method>>())
+      {
+        const auto& eventTypeInfo = typeInfo<Argument<Method>, TypeIds>();
+        auto* eventType = findEventType(eventTypeInfo.back());
+        if (!eventType)
+        {
+          // слот мог остаться от удаленного removeEmpty типа
+          eventType = &eventTypes[eventTypesCount++];
+          eventType->typeInfo = eventTypeInfo;
+          eventType->count = 0;
+        }
+        auto& handler = eventType->handlers[eventType->count++];
+        handler.fv = ObjectFunctionView(i_object, TemplateParameter<Method>(),
+                                        TypeIds());
+        handler.methodId = TypeIds::template methodId<Method>();
+        handler.pos = pos++;
+        handler.consumes = IsConsumingResult<Result<Method>>;
+        handler.hiddenCount = 0;
+      }
+    }
+
+    // обработчик объекта не вызывается для событий, производных от других
+    // типов, на которые подписан тот же объект; false - не хватило емкости,
+    // массивы не изменены
+    bool updateHiddenTypes(const void* i_object)
+    {
+      std::array<ArrayView2<TypeId>, Traits::maxEventTypes> objectTypes;
+      size_t objectTypesCount = 0;
+      for (size_t i = 0; i < eventTypesCount; ++i)
+      {
+        if (hasHandlers(eventTypes[i], i_object))
+        {
+          objectTypes[objectTypesCount++] = eventTypes[i].typeInfo;
+        }
+      }
+      const auto countHidden = [&](const ArrayView2<TypeId> eventType)
+      {
+        return std::count_if(begin(objectTypes),
+                             begin(objectTypes) + objectTypesCount,
+                             [eventType](const auto objectType)
+                             {
+                               return isStrictBase(eventType, objectType);
+                             });
+      };
+      for (size_t i = 0; i < objectTypesCount; ++i)
+      {
+        if (static_cast<size_t>(countHidden(objectTypes[i])) >
+            Traits::maxHiddenTypes)
+        {
+          return false;
+        }
+      }
+      for (size_t i = 0; i < eventTypesCount; ++i)
+      {
+        auto& eventType = eventTypes[i];
+        for (size_t j = 0; j < eventType.count; ++j)
+        {
+          auto& handler = eventType.handlers[j];
+          if (handler.fv.getObject() != i_object)
+          {
+            continue;
+          }
+          handler.hiddenCount = 0;
+          for (size_t k = 0; k < objectTypesCount; ++k)
+          {
+            if (isStrictBase(eventType.typeInfo, objectTypes[k]))
+            {
+              handler.hiddenTypes[handler.hiddenCount++] = objectTypes[k];
+            }
+          }
+        }
+      }
+      return true;
+    }
+
+    static inline bool hasHandlers(const FixedEventType& i_eventType,
+                                   const void* i_object)
+    {
+      return std::any_of(begin(i_eventType.handlers),
+                         begin(i_eventType.handlers) + i_eventType.count,
+                         [i_object](const auto& handler)
+                         {
+                           return handler.fv.getObject() == i_object;
+                         });
+    }
+
+    // во время доставки обработчики только выключаются
+    template<typename F>
+    size_t removeIf(F shouldRemove)
+    {
+      size_t disconnected = 0;
+      for (size_t i = 0; i < eventTypesCount; ++i)
+      {
+        auto& eventType = eventTypes[i];
+        for (size_t j = 0; j < eventType.count; ++j)
+        {
+          auto& handler = eventType.handlers[j];
+          if (!handler.fv.isDisabled() && shouldRemove(handler))
+          {
+            handler.fv.disable();
+            ++disconnected;
+          }
+        }
+      }
+      dirty = dirty || disconnected > 0;
+      if (depth == 0)
+      {
+        removeEmpty();
+      }
+      return disconnected;
+    }
+
+    void removeEmpty()
+    {
+      if (!dirty)
+      {
+        return;
+      }
+      size_t keptEventTypes = 0;
+      for (size_t i = 0; i < eventTypesCount; ++i)
+      {
+        auto& eventType = eventTypes[i];
+        size_t kept = 0;
+        for (size_t j = 0; j < eventType.count; ++j)
+        {
+          if (!eventType.handlers[j].fv.isDisabled())
+          {
+            if (kept != j)
+            {
+              eventType.handlers[kept] = eventType.handlers[j];
+            }
+            ++kept;
+          }
+        }
+        eventType.count = kept;
+        if (kept > 0)
+        {
+          if (keptEventTypes != i)
+          {
+            eventTypes[keptEventTypes] = eventType;
+          }
+          ++keptEventTypes;
+        }
+      }
+      // освободившиеся слоты пусты
+      for (size_t i = keptEventTypes; i < eventTypesCount; ++i)
+      {
+        eventTypes[i].count = 0;
+      }
+      eventTypesCount = keptEventTypes;
+      dirty = false;
+    }
+
+    std::array<FixedEventType, Traits::maxEventTypes> eventTypes;
+    size_t eventTypesCount = 0;
+    size_t pos = 0;
+    size_t depth = 0;
+    bool dirty = false;
+  };
+
+  using FixedInvokerContainer = BasicFixedInvokerContainer<>;
+}
@@ -4,6 +4,28 @@
 
 #include <tuple>
 
+// результат обработчика, который может остановить дальнейшую доставку
+enum class HandleResult
+{
+  Ignored,
+  Consumed
+};
+
+// bool (true - событие поглощено) или HandleResult
+template<typename R>
+constexpr bool IsConsumingResult =
+        std::is_same_v<R, bool> || std::is_same_v<R, HandleResult>;
+
+constexpr bool isConsumed(const bool i_result)
+{
+  return i_result;
+}
+
+constexpr bool isConsumed(const HandleResult i_result)
+{
+  return i_result == HandleResult::Consumed;
+}
+
 template<typename T>
 struct FunctionTraits;
 
@@ -12,11 +34,46 @@ struct FunctionTraits<R(C::*)(A)>
 {
   using Class = C;
   using Argument = typename std::remove_cv_t<std::remove_reference_t<A>>;
+  using Result = R;
+};
+
+template <typename C, typename R, typename A>
+struct FunctionTraits<R(C::*)(A) const> : FunctionTraits<R(C::*)(A)>
+{
+};
+
+template <typename R, typename A>
+struct FunctionTraits<R(*)(A)>
+{
+  using Class = void;
+  using Argument = typename std::remove_cv_t<std::remove_reference_t<A>>;
+  using Result = R;
 };
 
 template<auto Method>
 using Argument = typename FunctionTraits<decltype(Method)>::Argument;
 
+template<auto Method>
+using Result = typename FunctionTraits<decltype(Method)>::Result;
+
+// лямбды и функторы с единственным нешаблонным operator(), указатели на функции
+template<typename F, typename = void>
+struct CallableTraits : FunctionTraits<F>
+{
+};
+
+template<typename F>
+struct CallableTraits<F, std::void_t<decltype(&F::operator())>>
+        : FunctionTraits<decltype(&F::operator())>
+{
+};
+
+template<typename F>
+using CallableArgument = typename CallableTraits<F>::Argument;
+
+template<typename F>
+using CallableResult = typename CallableTraits<F>::Result;
+
 template<typename T,  typename ... TS>
 struct First
 {
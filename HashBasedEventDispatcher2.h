@@ -3,6 +3,7 @@
 #include "FunctionTraits.h"
 #include "ArrayView.h"
 
+#include <algorithm>
 #include <memory>
 #include <optional>
 #include <unordered_map>
@@ -156,7 +157,7 @@ namespace HB2
     }
 
     template<auto Method>
-    void disconnect(Class<Method>* object)
+    void disconnect(const Class<Method>* object)
     {
       disconnect(object, ValueHash<Method>);
     }
@@ -232,7 +233,7 @@ namespace HB2
     {
       if (auto* invoker = findInvoker<Argument<Method>>())
       {
-        invoker->disconnect<Method>(&i_object);
+        invoker->template disconnect<Method>(&i_object);
       }
     }
 
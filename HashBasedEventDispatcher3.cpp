@@ -13,7 +13,7 @@ namespace HB3
            i_base.typeId == i_derived[i_base.depthOfInheritance - 1];
   }
 
-  constexpr bool isBaseOrEqual(const ArrayView2<ArrayView2<TypeId>> i_bases,
+  inline bool isBaseOrEqual(const ArrayView2<ArrayView2<TypeId>> i_bases,
                                const ArrayView2<TypeId> i_derived)
   {
     return std::any_of(i_bases.begin(), i_bases.end(),
@@ -61,12 +61,15 @@ namespace HB3
     {
       return;
     }
+    OperationTimer timer(stats ? &stats->compaction : nullptr);
+    const auto size = handlers.size();
     handlers.erase(
             std::remove_if(begin(handlers), end(handlers), [](const auto& handler)
             {
               return !handler.has_value();
             }), end(handlers));
     dirty = false;
+    timer.record(size);
   }
 
   void InvokerContainerImpl::invoke(const void* i_event, const ArrayView2<TypeId> i_eventType)
@@ -98,12 +101,14 @@ namespace HB3
     {
       return;
     }
+    OperationTimer timer(&stats->removeEmpty);
+    const auto size = invokers.size();
     for (auto it = begin(invokers); it != end(invokers);)
     {
       if (it->second.isEmpty())
       {
-        it = invokers.erase(it);
         eventTypes.erase(it->first);
+        it = invokers.erase(it);
       }
       else
       {
@@ -111,6 +116,7 @@ namespace HB3
       }
     }
     dirty = false;
+    timer.record(size);
   }
 
   size_t InvokerContainerImpl::disconnect(const void* i_object)
@@ -2,8 +2,13 @@
 
 #include "FunctionTraits.h"
 #include "ArrayView.h"
+#include "SmallVector.h"
+#include "StructureStats.h"
 
+#include <algorithm>
+#include <array>
 #include <limits>
+#include <memory>
 #include <optional>
 #include <unordered_map>
 #include <vector>
@@ -141,7 +146,8 @@ namespace HB3
     }
 
     MethodId methodId;
-    std::vector<ArrayView2<TypeId>> notProcessesEvents;
+    // обычно пуст или из одного-двух типов: без выделения памяти
+    SmallVector<ArrayView2<TypeId>, 2> notProcessesEvents;
 
   private:
     FunctionView fv;
@@ -204,13 +210,14 @@ namespace HB3
     }
 
     void setNotProcessedEvents(const void* i_object,
-                               std::vector<ArrayView2<Hash>>&& notProcessedEvents)
+                               const std::vector<ArrayView2<Hash>>& notProcessedEvents)
     {
       for (auto& handler: handlers)
       {
         if (handler.has_value() && handler->getObject() == i_object)
         {
-          handler->notProcessesEvents = std::move(notProcessedEvents);
+          handler->notProcessesEvents.assign(notProcessedEvents.begin(),
+                                             notProcessedEvents.end());
         }
       }
     }
@@ -246,6 +253,8 @@ namespace HB3
     }
 
     std::vector<std::optional<Handler>> handlers;
+    // статистика контейнера-владельца
+    StructureStats* stats = nullptr;
 
   private:
     void removeEmpty();
@@ -280,7 +289,9 @@ namespace HB3
     inline void connect(const ArrayView2<TypeId> eventType,
                         const Handler& handler)
     {
-      invokers[eventType.back()].append(handler);
+      auto& invoker = invokers[eventType.back()];
+      invoker.stats = stats.get();
+      invoker.append(handler);
       registerType(eventType);
       updateDependencies(handler.getObject());
     }
@@ -360,11 +371,15 @@ namespace HB3
 
     inline std::vector<EventHandlersTreeNode> makeInvokersTree(const void* i_object)
     {
+      OperationTimer timer(&stats->makeInvokersTree);
       std::vector<EventHandlersTreeNode> result;
+      size_t handlersCount = 0;
       for (auto& [eventTypeId, invoker]: invokers)
       {
         updateTreeFrom(result, invoker, eventTypeId, i_object);
+        handlersCount += invoker.handlers.size();
       }
+      timer.record(handlersCount);
       return result;
     }
 
@@ -399,7 +414,8 @@ namespace HB3
          const auto directChildren = getDirectСhildren(nodes, node.value.eventTypeInfo);
          for (auto* handler: node.value.handlers)
          {
-           handler->notProcessesEvents = directChildren;
+           handler->notProcessesEvents.assign(begin(directChildren),
+                                              end(directChildren));
          }
         updateDependencies(node.subTree);
       }
@@ -408,7 +424,19 @@ namespace HB3
     inline void updateDependencies(const void* i_object)
     {
       auto invokersTree = makeInvokersTree(i_object);
+      OperationTimer timer(&stats->updateDependencies);
       updateDependencies(invokersTree);
+      timer.record(countNodes(invokersTree));
+    }
+
+    inline const StructureStats& getStructureStats() const
+    {
+      return *stats;
+    }
+
+    inline void resetStructureStats()
+    {
+      *stats = StructureStats();
     }
     
     void invoke(const void* i_event, const ArrayView2<TypeId> i_eventType);
@@ -441,6 +469,8 @@ namespace HB3
     std::unordered_map<TypeId, std::vector<TypeId>> eventTypes;
     bool isInInvokeProcess = false;
     bool dirty = false;
+    // в куче: на нее ссылаются Invoker
+    std::unique_ptr<StructureStats> stats = std::make_unique<StructureStats>();
   };
   
   struct InvokerContainer
@@ -477,11 +507,24 @@ namespace HB3
       }
       else
       {
-        return invokerContainerImpl.disconnect(&i_object, {EventMethodType{
-                TypeHash<Argument<Methods>>, ValueHash<Methods>}...});
+        const std::array<EventMethodType, sizeof...(Methods)> eventMethodTypes{
+                EventMethodType{TypeHash<Argument<Methods>>, ValueHash<Methods>}...};
+        return invokerContainerImpl.disconnect(&i_object, eventMethodTypes);
       }
     }
 
+    // счетчики и время перестроений дерева зависимостей и уплотнений массивов;
+    // время не измеряется при сборке с STRUCTURE_STATS_NO_TIMING
+    const StructureStats& getStructureStats() const
+    {
+      return invokerContainerImpl.getStructureStats();
+    }
+
+    void resetStructureStats()
+    {
+      invokerContainerImpl.resetStructureStats();
+    }
+
   private:
     InvokerContainerImpl invokerContainerImpl;
   };
@@ -1,9 +1,327 @@
 #include "HashBasedEventDispatcher4.h"
 
+#include <functional>
+#include <mutex>
 #include <numeric>
+#include <queue>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
 
 namespace HB4
 {
+  namespace
+  {
+    void appendJsonString(std::string& json, const std::string_view i_value)
+    {
+      json += '"';
+      for (const auto c: i_value)
+      {
+        if (c == '"' || c == '\\')
+        {
+          json += '\\';
+        }
+        json += c;
+      }
+      json += '"';
+    }
+  }
+
+  Hash internTypeId(const size_t i_hash, const std::string_view i_name)
+  {
+    struct InternedTypeId
+    {
+      size_t hash;
+      std::string name;
+    };
+    static std::mutex mutex;
+    // узлы unordered_map не перемещаются: адрес hash и есть идентификатор
+    static std::unordered_map<size_t, InternedTypeId> typeIds;
+
+    const std::lock_guard lock(mutex);
+    const auto [it, inserted] =
+            typeIds.try_emplace(i_hash, InternedTypeId{i_hash, std::string(i_name)});
+    if (!inserted && it->second.name != i_name)
+    {
+      throw std::logic_error("HB4: type hash collision between " +
+                             it->second.name + " and " + std::string(i_name));
+    }
+    return &it->second.hash;
+  }
+
+#ifdef HB4_PROFILE_HANDLERS
+  namespace
+  {
+    std::mutex& profileMutex()
+    {
+      static std::mutex mutex;
+      return mutex;
+    }
+
+    // deque: адреса записей не меняются, на них ссылаются списки доставки
+    std::deque<HandlerProfileRecord>& profileRecords()
+    {
+      static std::deque<HandlerProfileRecord> records;
+      return records;
+    }
+
+    std::unordered_map<const void*, std::vector<HandlerProfileRecord*>>&
+    profileRecordsByObject()
+    {
+      static std::unordered_map<const void*,
+                                std::vector<HandlerProfileRecord*>> records;
+      return records;
+    }
+
+    // освобожденные записи profileRecords
+    std::vector<HandlerProfileRecord*>& freeProfileRecords()
+    {
+      static std::vector<HandlerProfileRecord*> records;
+      return records;
+    }
+  }
+
+  HandlerProfileRecord* profileRecord(const void* i_object,
+                                      const MethodId i_methodId,
+                                      const std::string_view i_name)
+  {
+    const std::lock_guard lock(profileMutex());
+    auto& objectRecords = profileRecordsByObject()[i_object];
+    for (auto* record: objectRecords)
+    {
+      if (record->methodId == i_methodId)
+      {
+        ++record->handlers;
+        return record;
+      }
+    }
+    auto& freeRecords = freeProfileRecords();
+    HandlerProfileRecord* record = nullptr;
+    if (freeRecords.empty())
+    {
+      record = &profileRecords().emplace_back();
+    }
+    else
+    {
+      record = freeRecords.back();
+      freeRecords.pop_back();
+    }
+    record->object = i_object;
+    record->methodId = i_methodId;
+    record->name = i_name;
+    record->handlers = 1;
+    objectRecords.push_back(record);
+    return record;
+  }
+
+  void releaseProfileRecord(HandlerProfileRecord* i_record)
+  {
+    const std::lock_guard lock(profileMutex());
+    if (--i_record->handlers > 0)
+    {
+      return;
+    }
+    // объект, подключенный позже по тому же адресу, начнет с нуля
+    const auto objectRecords = profileRecordsByObject().find(i_record->object);
+    auto& records = objectRecords->second;
+    records.erase(std::find(begin(records), end(records), i_record));
+    if (records.empty())
+    {
+      profileRecordsByObject().erase(objectRecords);
+    }
+    i_record->name.clear();
+    i_record->calls = 0;
+    i_record->totalTicks = 0;
+    i_record->maxTicks = 0;
+    freeProfileRecords().push_back(i_record);
+  }
+
+  std::vector<HandlerProfile> profileSnapshot()
+  {
+    const std::lock_guard lock(profileMutex());
+    std::vector<HandlerProfile> result;
+    for (const auto& record: profileRecords())
+    {
+      if (record.handlers == 0)
+      {
+        continue;
+      }
+      result.push_back({record.object, record.methodId, record.name,
+                        record.calls.load(std::memory_order_relaxed),
+                        record.totalTicks.load(std::memory_order_relaxed),
+                        record.maxTicks.load(std::memory_order_relaxed)});
+    }
+    return result;
+  }
+
+  std::string profileReport()
+  {
+    auto profiles = profileSnapshot();
+    std::sort(begin(profiles), end(profiles),
+              [](const auto& left, const auto& right)
+              {
+                return left.totalTicks > right.totalTicks;
+              });
+    std::ostringstream report;
+    report << "calls\ttotal\tmax\tavg\tobject\thandler\n";
+    for (const auto& profile: profiles)
+    {
+      if (profile.calls == 0)
+      {
+        continue;
+      }
+      report << profile.calls << '\t' << profile.totalTicks << '\t'
+             << profile.maxTicks << '\t'
+             << profile.totalTicks / profile.calls << '\t'
+             << profile.object << '\t' << profile.name << '\n';
+    }
+    return report.str();
+  }
+
+  void resetProfile()
+  {
+    const std::lock_guard lock(profileMutex());
+    for (auto& record: profileRecords())
+    {
+      record.calls = 0;
+      record.totalTicks = 0;
+      record.maxTicks = 0;
+    }
+  }
+#endif
+
+#ifdef HB4_TRACE_DISPATCH
+  namespace
+  {
+    std::mutex& traceMutex()
+    {
+      static std::mutex mutex;
+      return mutex;
+    }
+
+    // буферы завершившихся потоков тоже попадают в трассу
+    std::deque<TraceBuffer>& traceBuffers()
+    {
+      static std::deque<TraceBuffer> buffers;
+      return buffers;
+    }
+
+    // сброшенные буферы завершившихся потоков
+    std::vector<TraceBuffer*>& freeTraceBuffers()
+    {
+      static std::vector<TraceBuffer*> buffers;
+      return buffers;
+    }
+
+    uint64_t lastTraceThreadId = 0;
+  }
+
+  const std::string* internTraceName(const std::string_view i_name)
+  {
+    // узлы unordered_set не перемещаются
+    static std::unordered_set<std::string> names;
+    const std::lock_guard lock(traceMutex());
+    return &*names.emplace(i_name).first;
+  }
+
+  TraceBuffer& registerTraceBuffer()
+  {
+    const std::lock_guard lock(traceMutex());
+    auto& freeBuffers = freeTraceBuffers();
+    TraceBuffer* buffer = nullptr;
+    if (freeBuffers.empty())
+    {
+      buffer = &traceBuffers().emplace_back();
+    }
+    else
+    {
+      buffer = freeBuffers.back();
+      freeBuffers.pop_back();
+      buffer->next.store(0, std::memory_order_relaxed);
+      buffer->flushed = 0;
+      buffer->retired = false;
+    }
+    buffer->threadId = ++lastTraceThreadId;
+    return *buffer;
+  }
+
+  void releaseTraceBuffer(TraceBuffer& i_buffer)
+  {
+    const std::lock_guard lock(traceMutex());
+    if (i_buffer.flushed == i_buffer.next.load(std::memory_order_acquire))
+    {
+      freeTraceBuffers().push_back(&i_buffer);
+    }
+    else
+    {
+      i_buffer.retired = true;
+    }
+  }
+
+  std::string flushTraceJson()
+  {
+    const std::lock_guard lock(traceMutex());
+    const auto nsPerTick = LatencyHistogram::nsPerTick();
+    std::string json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    std::vector<TraceRecord> records;
+    for (auto& buffer: traceBuffers())
+    {
+      // копия записей проверяется по next, как в seqlock: поток мог
+      // затереть начало кольца, пока оно копировалось
+      const auto end = buffer.next.load(std::memory_order_acquire);
+      const auto begin = std::max(buffer.flushed,
+                                  end > TraceBuffer::capacity ?
+                                  end - TraceBuffer::capacity : 0);
+      records.clear();
+      for (auto i = begin; i < end; ++i)
+      {
+        records.push_back(buffer.records[i % TraceBuffer::capacity]);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      const auto written = buffer.next.load(std::memory_order_relaxed);
+      const auto overwritten = written > TraceBuffer::capacity ?
+                               written - TraceBuffer::capacity : 0;
+      const auto skipped = std::min(overwritten > begin ? overwritten - begin : 0,
+                                    records.size());
+      buffer.flushed = end;
+      if (buffer.retired)
+      {
+        buffer.retired = false;
+        freeTraceBuffers().push_back(&buffer);
+      }
+      for (size_t i = skipped; i < records.size(); ++i)
+      {
+        const auto& record = records[i];
+        json += first ? "{\"name\":" : ",{\"name\":";
+        first = false;
+        if (!record.name)
+        {
+          std::ostringstream id;
+          id << record.id;
+          appendJsonString(json, id.str());
+        }
+        else
+        {
+          appendJsonString(json, *record.name);
+        }
+        std::ostringstream timestamp;
+        timestamp.precision(3);
+        timestamp << std::fixed
+                  << static_cast<double>(record.ticks) * nsPerTick / 1000.0;
+        json += record.isHandler ? ",\"cat\":\"handler\"" :
+                ",\"cat\":\"dispatch\"";
+        json += ",\"ph\":\"";
+        json += record.phase;
+        json += "\",\"ts\":" + timestamp.str() + ",\"pid\":1,\"tid\":" +
+                std::to_string(buffer.threadId) + "}";
+      }
+    }
+    json += "]}";
+    return json;
+  }
+#endif
 
   constexpr bool isBaseOrEqual(const ShortTypeInfo i_base,
                                const ArrayView2<TypeId> i_derived)
@@ -13,7 +331,7 @@ namespace HB4
            i_base.typeId == i_derived[i_base.depthOfInheritance - 1];
   }
 
-  constexpr bool isBaseOrEqual(const ArrayView2<ArrayView2<TypeId>> i_bases,
+  inline bool isBaseOrEqual(const ArrayView2<ArrayView2<TypeId>> i_bases,
                                const ArrayView2<TypeId> i_derived)
   {
     return std::any_of(i_bases.begin(), i_bases.end(),
@@ -23,6 +341,19 @@ namespace HB4
                        });
   }
 
+#ifdef HB4_PROFILE_HANDLERS
+  Invoker::~Invoker()
+  {
+    for (const auto& handler: handlers)
+    {
+      if (handler.has_value())
+      {
+        releaseProfileRecord(handler->profile);
+      }
+    }
+  }
+#endif
+
   size_t Invoker::disconnect(const void* object)
   {
     return removeIf(object, [](const auto&)
@@ -45,12 +376,15 @@ namespace HB4
     {
       return;
     }
+    OperationTimer timer(stats ? &stats->compaction : nullptr);
+    const auto size = handlers.size();
     handlers.erase(std::remove_if(begin(handlers), end(handlers),
                                   [](const auto& handler)
                                   {
                                     return !handler.has_value();
                                   }), end(handlers));
     dirty = false;
+    timer.record(size);
   }
 
   void SimpleInvoker::removeEmpty()
@@ -59,67 +393,485 @@ namespace HB4
     {
       return;
     }
+    OperationTimer timer(stats ? &stats->compaction : nullptr);
+    const auto size = functions.size();
     functions.erase(std::remove_if(begin(functions), end(functions),
                                    [](const auto& function)
                                    {
-                                     return !function.value.has_value();
+                                     return function.fv.isDisabled();
                                    }), end(functions));
     dirty = false;
+    timer.record(size);
   }
 
-  void InvokerContainerImpl::updateSimpleInvokers()
+  void orderHandlers(std::pmr::vector<const Handler*>& handlers,
+                     const std::pmr::vector<HandlerOrdering>& orderings)
   {
-    if (simpleInvokersUpdated || isInInvokeProcess)
+    std::sort(begin(handlers), end(handlers),
+              [](const auto* left, const auto* right)
+              {
+                return left->priority != right->priority ?
+                       left->priority > right->priority :
+                       left->pos < right->pos;
+              });
+    if (orderings.empty())
     {
       return;
     }
-    simpleInvokers.clear();
-    for (const auto&[eventTypeId, invoker]: invokers)
+    // временные таблицы берут память из ресурса списка
+    const auto resource = handlers.get_allocator().resource();
+    // после сортировки индекс в handlers и есть ключ (priority, pos)
+    std::pmr::unordered_map<HandlerKey, std::pmr::vector<size_t>, HandlerKeyHash>
+            indices(resource);
+    for (size_t i = 0; i < handlers.size(); ++i)
+    {
+      indices[HandlerKey{handlers[i]->getObject(), handlers[i]->methodId}]
+              .push_back(i);
+    }
+    // ребра между обработчиками этого списка
+    std::pmr::vector<std::pmr::vector<size_t>> successors(handlers.size(),
+                                                         resource);
+    std::pmr::vector<size_t> predecessors(handlers.size(), 0, resource);
+    for (const auto& ordering: orderings)
     {
-      auto& simpleInvoker = simpleInvokers[eventTypeId];
-      for (const auto& handler: invoker.handlers)
+      const auto before = indices.find(ordering.before);
+      const auto after = indices.find(ordering.after);
+      if (before == end(indices) || after == end(indices))
+      {
+        continue;
+      }
+      for (const auto b: before->second)
+      {
+        for (const auto a: after->second)
+        {
+          successors[b].push_back(a);
+          ++predecessors[a];
+        }
+      }
+    }
+    // алгоритм Кана: из готовых каждый раз берем первый по приоритету;
+    // циклов нет: они отсекаются в checkOrdering
+    std::priority_queue<size_t, std::pmr::vector<size_t>, std::greater<>>
+            ready{std::greater<>(), std::pmr::vector<size_t>(resource)};
+    for (size_t i = 0; i < handlers.size(); ++i)
+    {
+      if (predecessors[i] == 0)
+      {
+        ready.push(i);
+      }
+    }
+    std::pmr::vector<const Handler*> result(handlers.get_allocator());
+    result.reserve(handlers.size());
+    while (!ready.empty())
+    {
+      const auto next = ready.top();
+      ready.pop();
+      result.push_back(handlers[next]);
+      for (const auto successor: successors[next])
+      {
+        if (--predecessors[successor] == 0)
+        {
+          ready.push(successor);
+        }
+      }
+    }
+    handlers = std::move(result);
+  }
+
+  void groupHandlersByFunction(std::pmr::vector<const Handler*>& handlers)
+  {
+    // внутри группы сохраняется порядок подключения
+    std::stable_sort(begin(handlers), end(handlers),
+                     [](const auto* left, const auto* right)
+                     {
+                       return std::less<FunctionView::F>()(
+                               left->fv.getFunction(), right->fv.getFunction());
+                     });
+  }
+
+  void checkOrdering(const std::pmr::vector<HandlerOrdering>& orderings,
+                     const HandlerOrdering& ordering)
+  {
+    // цикл появится, если из after уже достижим before
+    std::pmr::vector<HandlerKey> reached({ordering.after},
+                                         orderings.get_allocator());
+    for (size_t i = 0; i < reached.size(); ++i)
+    {
+      if (reached[i] == ordering.before)
+      {
+        throw std::logic_error("HB4: handler ordering constraint makes a cycle");
+      }
+      for (const auto& existing: orderings)
+      {
+        if (existing.before == reached[i] &&
+            std::find(begin(reached), end(reached), existing.after) ==
+            end(reached))
+        {
+          reached.push_back(existing.after);
+        }
+      }
+    }
+  }
+
+  void InvokerContainerImpl::updateSimpleInvoker(SimpleInvoker& simpleInvoker,
+                                                const ArrayView2<TypeId> i_eventType)
+  {
+    simpleInvoker.stats = stats.get();
+    // буфер переиспользуется между перестроениями
+    auto& handlers = orderedHandlers;
+    handlers.clear();
+    if (auto* invoker = findInvoker(i_eventType.back()))
+    {
+      for (const auto& handler: invoker->handlers)
       {
         if (handler.has_value())
         {
-          simpleInvoker.append(handler->pos, handler->fv);
+          handlers.push_back(&*handler);
         }
       }
-      const auto eventTypeInfo = getTypeInfo(eventTypeId);
-      auto baseEventType = eventTypeInfo;
-      while (!(--baseEventType).empty())
+    }
+    auto baseEventType = i_eventType;
+    while (!(--baseEventType).empty())
+    {
+      if (auto* invoker = findInvoker(baseEventType.back()))
       {
-        if (auto* invoker = findInvoker(baseEventType.back()))
+        for (const auto& handler: invoker->handlers)
         {
-          for (const auto& handler: invoker->handlers)
+          if (handler.has_value() &&
+              !isBaseOrEqual(handler->notProcessesEvents, i_eventType))
           {
-            if (handler.has_value() &&
-                !isBaseOrEqual(handler->notProcessesEvents, eventTypeInfo))
-            {
-              simpleInvoker.append(handler->pos, handler->fv);
-            }
+            handlers.push_back(&*handler);
           }
         }
       }
-      simpleInvoker.sort();
     }
+    if (std::find(begin(unorderedEventTypes), end(unorderedEventTypes),
+                  i_eventType.back()) != end(unorderedEventTypes))
+    {
+      std::sort(begin(handlers), end(handlers),
+                [](const auto* left, const auto* right)
+                {
+                  return left->pos < right->pos;
+                });
+      groupHandlersByFunction(handlers);
+    }
+    else
+    {
+      orderHandlers(handlers, orderings);
+    }
+    for (const auto* handler: handlers)
+    {
+      simpleInvoker.append(*handler);
+    }
+  }
+
+  void InvokerContainerImpl::removeOrderings(const void* i_object)
+  {
+    removeOrderingsIf([i_object](const HandlerKey& handler)
+                      {
+                        return handler.object == i_object;
+                      });
+  }
+
+  void InvokerContainerImpl::removeOrderings(const void* i_object,
+                                             const MethodId i_methodId)
+  {
+    removeOrderingsIf([handler = HandlerKey{i_object, i_methodId}](
+            const HandlerKey& other)
+                      {
+                        return other == handler;
+                      });
+  }
+
+  bool InvokerContainerImpl::updateSimpleInvokers()
+  {
+    if (isInInvokeProcess)
+    {
+      return false;
+    }
+    if (simpleInvokersUpdated)
+    {
+      return applyPendingChanges();
+    }
+    OperationTimer timer(&stats->updateSimpleInvokers);
+    simpleInvokers.clear();
+    derivedEventTypes.clear();
+    for (const auto&[eventTypeId, eventTypeInfo]: eventTypes)
+    {
+      updateSimpleInvoker(createSimpleInvoker(eventTypeInfo), eventTypeInfo);
+    }
+    pendingHandlers.clear();
+    staleEventTypes.clear();
     simpleInvokersUpdated = true;
+    timer.record(eventTypes.size());
+    return true;
+  }
+
+  DispatchLatency& LatencyReport::get(const TypeId i_eventTypeId,
+                                      const std::string_view i_name)
+  {
+    auto& latency = eventTypes[i_eventTypeId];
+    if (!latency)
+    {
+      latency = std::make_unique<DispatchLatency>();
+    }
+    if (latency->name.empty())
+    {
+      latency->name = i_name;
+    }
+    return *latency;
+  }
+
+  void LatencyReport::merge(const LatencyReport& i_other)
+  {
+    for (const auto&[eventTypeId, latency]: i_other.eventTypes)
+    {
+      auto& merged = get(eventTypeId, latency->name);
+      merged.dispatch.merge(latency->dispatch);
+      merged.rebuild.merge(latency->rebuild);
+    }
+  }
+
+  std::string LatencyReport::toJson() const
+  {
+    const auto nsPerTick = LatencyHistogram::nsPerTick();
+    std::string json = "{";
+    for (const auto&[eventTypeId, latency]: eventTypes)
+    {
+      if (json.size() > 1)
+      {
+        json += ",";
+      }
+      if (latency->name.empty())
+      {
+        std::ostringstream id;
+        id << eventTypeId;
+        appendJsonString(json, id.str());
+      }
+      else
+      {
+        appendJsonString(json, latency->name);
+      }
+      json += ":{\"dispatch\":" +
+              latency->dispatch.toJson(nsPerTick) + ",\"rebuild\":" +
+              latency->rebuild.toJson(nsPerTick) + "}";
+    }
+    json += "}";
+    return json;
+  }
+
+  InvokerContainerImpl::InvokerContainerImpl(
+          std::pmr::memory_resource* i_resource)
+          : invokers(i_resource),
+            eventTypes(i_resource),
+            simpleInvokers(i_resource),
+            orderings(i_resource),
+            unorderedEventTypes(i_resource),
+            pendingHandlers(i_resource),
+            derivedEventTypes(i_resource),
+            objectHandlers(i_resource),
+            staleEventTypes(i_resource),
+            orderedHandlers(i_resource),
+            ownSubscribers(i_resource),
+            subscribers(i_resource)
+  {
+  }
+
+  size_t InvokerContainerImpl::countSubscribers(
+          const ArrayView2<TypeId> i_eventType)
+  {
+    registerType(i_eventType);
+    size_t count = 0;
+    for (const auto typeId: i_eventType)
+    {
+      if (const auto it = ownSubscribers.find(typeId);
+              it != end(ownSubscribers))
+      {
+        count += it->second;
+      }
+    }
+    subscribers[i_eventType.back()] = count;
+    return count;
+  }
+
+  void InvokerContainerImpl::changeSubscribers(const TypeId i_eventTypeId,
+                                               const ptrdiff_t i_delta)
+  {
+    ownSubscribers[i_eventTypeId] += i_delta;
+    const auto eventType = getTypeInfo(i_eventTypeId);
+    for (auto&[typeId, count]: subscribers)
+    {
+      if (isBaseOrEqual(eventType, getTypeInfo(typeId)))
+      {
+        count += i_delta;
+      }
+    }
+  }
+
+  void InvokerContainerImpl::markStale(const ArrayView2<TypeId> i_eventType)
+  {
+    const auto derived = getDerivedEventTypes(i_eventType.back());
+    staleEventTypes.insert(end(staleEventTypes), derived.begin(), derived.end());
+  }
+
+  SimpleInvoker& InvokerContainerImpl::createSimpleInvoker(
+          const ArrayView2<TypeId> i_eventType)
+  {
+    const auto[it, inserted] = simpleInvokers.try_emplace(i_eventType.back());
+    if (inserted)
+    {
+      for (const auto typeId: i_eventType)
+      {
+        derivedEventTypes[typeId].push_back(i_eventType.back());
+      }
+    }
+    return it->second;
+  }
+
+  bool InvokerContainerImpl::canAppend(const TypeId i_eventTypeId,
+                                       const Handler& i_handler)
+  {
+    // без приоритетов в списке и ограничений на новый обработчик
+    // он - последний в списке
+    if (i_handler.priority != 0)
+    {
+      return false;
+    }
+    for (const auto typeId: getTypeInfo(i_eventTypeId))
+    {
+      const auto* invoker = findInvoker(typeId);
+      if (invoker && invoker->prioritized > 0)
+      {
+        return false;
+      }
+    }
+    const HandlerKey key{i_handler.getObject(), i_handler.methodId};
+    return std::none_of(begin(orderings), end(orderings),
+                        [&key](const auto& ordering)
+                        {
+                          return ordering.before == key || ordering.after == key;
+                        }) &&
+           std::find(begin(unorderedEventTypes), end(unorderedEventTypes),
+                     i_eventTypeId) == end(unorderedEventTypes) &&
+           std::find(begin(staleEventTypes), end(staleEventTypes),
+                     i_eventTypeId) == end(staleEventTypes);
+  }
+
+  bool InvokerContainerImpl::applyPendingChanges()
+  {
+    if (pendingHandlers.empty() && staleEventTypes.empty())
+    {
+      return false;
+    }
+    OperationTimer timer(&stats->applyPendingChanges);
+    const auto input = pendingHandlers.size() + staleEventTypes.size();
+    for (const auto& pending: pendingHandlers)
+    {
+      auto* invoker = findInvoker(pending.eventTypeId);
+      const auto* handler = invoker ? invoker->find(pending.index, pending.pos)
+                                    : nullptr;
+      // уже отключен
+      if (!handler)
+      {
+        continue;
+      }
+      for (const auto eventTypeId: getDerivedEventTypes(pending.eventTypeId))
+      {
+        if (isBaseOrEqual(handler->notProcessesEvents, getTypeInfo(eventTypeId)))
+        {
+          continue;
+        }
+        if (canAppend(eventTypeId, *handler))
+        {
+          simpleInvokers.find(eventTypeId)->second.append(*handler);
+        }
+        else
+        {
+          staleEventTypes.push_back(eventTypeId);
+        }
+      }
+    }
+    pendingHandlers.clear();
+
+    std::sort(begin(staleEventTypes), end(staleEventTypes));
+    staleEventTypes.erase(std::unique(begin(staleEventTypes),
+                                      end(staleEventTypes)),
+                          end(staleEventTypes));
+    OperationTimer rebuildTimer(staleEventTypes.empty() ? nullptr :
+                                &stats->rebuildStale);
+    for (const auto eventTypeId: staleEventTypes)
+    {
+      if (auto* simpleInvoker = findSimpleInvoker(eventTypeId))
+      {
+        simpleInvoker->clear();
+        updateSimpleInvoker(*simpleInvoker, getTypeInfo(eventTypeId));
+      }
+    }
+    rebuildTimer.record(staleEventTypes.size());
+    staleEventTypes.clear();
+    timer.record(input);
+    return true;
   }
 
-  void InvokerContainerImpl::invoke(const void* i_event,
-                                    const ArrayView2<TypeId> i_eventType)
+  bool InvokerContainerImpl::invoke(const void* i_event,
+                                    const ArrayView2<TypeId> i_eventType,
+                                    ResultSink* i_sink,
+                                    const std::string_view i_eventName)
   {
     const auto firstLevel = !isInInvokeProcess;
-    updateSimpleInvokers();
+#ifdef HB4_TRACE_DISPATCH
+    const TraceDispatchScope traceScope(i_eventName, i_eventType.back());
+#endif
+    // замеряется каждая latencySampling-я доставка и каждая, перед которой
+    // ждут изменения списков (перестроения редки, выборка бы их теряла)
+    auto measure = false;
+    if (latencyEnabled)
+    {
+      measure = --latencyCountdown == 0 ||
+                (!isInInvokeProcess &&
+                 (!simpleInvokersUpdated || !pendingHandlers.empty() ||
+                  !staleEventTypes.empty()));
+      latencyCountdown = latencyCountdown == 0 ? latencySampling : latencyCountdown;
+    }
+    const auto begin = measure ? LatencyHistogram::now() : 0;
+    auto updated = updateSimpleInvokers();
     isInInvokeProcess = true;
-    if (auto* invoker = findSimpleInvoker(i_eventType.back()))
+    const ScopeExit invokeExit([this, firstLevel]()
+                               {
+                                 isInInvokeProcess = isInInvokeProcess &&
+                                                     !firstLevel;
+                               });
+    auto* invoker = findSimpleInvoker(i_eventType.back());
+    if (!invoker)
     {
-      invoker->invoke(i_event);
+      // тип без собственных обработчиков (например, производное событие,
+      // пришедшее через invokeDynamic): строим список из обработчиков базовых
+      // типов один раз и запоминаем его
+      registerType(i_eventType);
+      invoker = &createSimpleInvoker(getTypeInfo(i_eventType.back()));
+      updateSimpleInvoker(*invoker, getTypeInfo(i_eventType.back()));
+      updated = true;
+    }
+    const auto consumed = invoker->invoke(i_event, i_sink, mutedGroups);
+    if (measure)
+    {
+      const auto elapsed = LatencyHistogram::now() - begin;
+      // гистограммы списка запоминаются в нем: поиск - один раз на список
+      // (и еще раз, если имя типа стало известно позже)
+      if (!invoker->latency ||
+          (invoker->latency->name.empty() && !i_eventName.empty()))
+      {
+        invoker->latency = &latencyReport.get(i_eventType.back(), i_eventName);
+      }
+      (updated ? invoker->latency->rebuild : invoker->latency->dispatch)
+              .record(elapsed);
     }
     if (firstLevel)
     {
       isInInvokeProcess = false;
       removeEmpty();
     }
+    return consumed;
   }
 
   void InvokerContainerImpl::removeEmpty()
@@ -128,12 +880,15 @@ namespace HB4
     {
       return;
     }
+    OperationTimer timer(&stats->removeEmpty);
+    const auto size = invokers.size();
     for (auto it = begin(invokers); it != end(invokers);)
     {
+      // eventTypes не удаляем: на них ссылаются notProcessesEvents
+      // и списки для типов без собственных обработчиков
       if (it->second.isEmpty())
       {
         it = invokers.erase(it);
-        eventTypes.erase(it->first);
       }
       else
       {
@@ -141,21 +896,90 @@ namespace HB4
       }
     }
     dirty = false;
+    timer.record(size);
+  }
+
+  bool InvokerContainerImpl::hasRelatedHandlers(
+          const void* i_object, const ArrayView2<TypeId> i_eventType) const
+  {
+    if (!hasHandlers(i_object))
+    {
+      return false;
+    }
+    for (const auto&[eventTypeId, invoker]: invokers)
+    {
+      const auto it = eventTypes.find(eventTypeId);
+      const ArrayView2<TypeId> eventType = it->second;
+      if ((isBaseOf(eventType, i_eventType) || isBaseOf(i_eventType, eventType)) &&
+          std::any_of(begin(invoker.handlers), end(invoker.handlers),
+                      [i_object](const auto& handler)
+                      {
+                        return handler.has_value() &&
+                               handler->getObject() == i_object;
+                      }))
+      {
+        return true;
+      }
+    }
+    return false;
   }
 
   size_t InvokerContainerImpl::disconnect(const void* i_object)
   {
     size_t disconnected = 0;
-    for (auto&[_, invoker]: invokers)
+    for (auto&[eventTypeId, invoker]: invokers)
     {
-      disconnected += invoker.disconnect(i_object);
+      if (const auto n = invoker.disconnect(i_object); n > 0)
+      {
+        changeSubscribers(eventTypeId, -static_cast<ptrdiff_t>(n));
+        disconnected += n;
+      }
+    }
+    if (disconnected > 0)
+    {
+      // объект отключен целиком: скрытие для других объектов не меняется
+      for (auto&[_, simpleInvoker]: simpleInvokers)
+      {
+        simpleInvoker.disconnect(i_object);
+      }
+      removeOrderings(i_object);
+      objectDisconnected(i_object, disconnected);
     }
     dirty = disconnected > 0;
-    simpleInvokersUpdated = dirty;
     removeEmpty();
     return disconnected;
   }
 
+  size_t InvokerContainerImpl::disconnect1(const void* i_object,
+                                           const EventMethodType hash)
+  {
+    auto* invoker = findInvoker(hash.event);
+    if (!invoker)
+    {
+      return 0;
+    }
+    const auto disconnected = invoker->disconnect(i_object, hash.method);
+    if (disconnected == 0)
+    {
+      return 0;
+    }
+    changeSubscribers(hash.event, -static_cast<ptrdiff_t>(disconnected));
+    removeOrderings(i_object, hash.method);
+    objectDisconnected(i_object, disconnected);
+    const auto eventType = getTypeInfo(hash.event);
+    for (const auto eventTypeId: getDerivedEventTypes(hash.event))
+    {
+      simpleInvokers.find(eventTypeId)->second.disconnect(i_object, hash.method);
+    }
+    if (hasHandlers(i_object))
+    {
+      // обработчики объекта для базовых типов больше не скрыты
+      updateDependencies(i_object);
+      markStale(eventType);
+    }
+    return disconnected;
+  }
+
   size_t InvokerContainerImpl::disconnect(const void* i_object,
                                           const ArrayView2<EventMethodType> i_eventMethodTypes)
   {
@@ -170,7 +994,6 @@ namespace HB4
                                                                    eventMethodType);
                                               });
     dirty = disconnected > 0;
-    simpleInvokersUpdated = dirty;
     removeEmpty();
     return disconnected;
   }
@@ -2,12 +2,41 @@
 
 #include "FunctionTraits.h"
 #include "ArrayView.h"
-
+#include "LatencyHistogram.h"
+#include "SmallVector.h"
+#include "StructureStats.h"
+#include "TypeHash.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <limits>
+#include <memory>
+#include <memory_resource>
+#include <new>
 #include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
+#ifdef HB4_PROFILE_HANDLERS
+#include <atomic>
+#include <chrono>
+#include <string>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
+
+#ifdef HB4_TRACE_DISPATCH
+#include <atomic>
+#endif
+
 namespace HB4
 {
   // primary template handles types that have no nested ::Base member:
@@ -42,24 +71,6 @@ namespace HB4
 
   using Hash = const size_t*;
 
-  template<typename T, typename A>
-  constexpr auto collectBaseHashesInt(A& hashes, size_t i)
-  {
-    hashes[--i] = TypeHash<T>; // корень
-    if constexpr (HasBaseMember<T>::value)
-    {
-      collectBaseHashesInt<typename T::Base>(hashes, i);
-    }
-  }
-
-  template<typename T>
-  constexpr auto collectBaseHashes()
-  {
-    std::array<Hash, countBaseClasses<T>()> hashes{};
-    collectBaseHashesInt<T>(hashes, hashes.size());
-    return hashes;
-  }
-
   template<auto T>
   struct ValueHashHolder
   {
@@ -73,498 +84,3080 @@ namespace HB4
   {
   };
 
-  using TypeId = Hash;
-  using MethodId = Hash;
+  template<typename T>
+  struct TemplateType
+  {
+  };
 
-  struct ShortTypeInfo
+  // идентификатор - адрес статической переменной: самый дешевый, но в
+  // модулях, загруженных через dlopen, адрес может отличаться
+  struct AddressTypeIds
   {
-    constexpr ShortTypeInfo(ArrayView2<TypeId> i_TypeInfo) : typeId(
-            i_TypeInfo.back()), depthOfInheritance(i_TypeInfo.size())
+    template<typename T>
+    static constexpr Hash typeId()
     {
+      return TypeHash<T>;
     }
 
-    constexpr inline bool empty() const
+    template<auto Method>
+    static constexpr Hash methodId()
     {
-      return depthOfInheritance == 0;
+      return ValueHash<Method>;
     }
-
-    TypeId typeId;
-    size_t depthOfInheritance;
   };
 
-  struct FunctionView
+  // возвращает единый для процесса указатель для FNV хэша type_hash<T>();
+  // при совпадении хэшей разных типов бросает std::logic_error.
+  // определена в HashBasedEventDispatcher4.cpp: плагины должны разрешать
+  // этот символ из исполняемого файла (экспортируйте его символы)
+  Hash internTypeId(size_t i_hash, std::string_view i_name);
+
+  // идентификатор одинаков во всех модулях процесса; после интернирования
+  // сравнение по-прежнему сравнивает указатели.
+  // Типы из анонимных пространств имен, лямбды, безымянные и локальные для
+  // функций классы одинаково называются в разных единицах трансляции и
+  // модулях, хотя это разные типы: им дается адресный идентификатор (из
+  // другого модуля такой тип все равно не назвать)
+  struct StableTypeIds
   {
-    template<auto Method>
-    FunctionView(TemplateParameter<Method>):
-            func([](void* object, const void* event)
-                 {
-                   (static_cast<Class<Method>*>(object)->*Method)(
-                           *static_cast<const Argument<Method>*>(event));
-                 })
+    template<typename T>
+    static Hash typeId()
     {
+      if constexpr (is_tu_local_name(type_name<T>()))
+      {
+        return AddressTypeIds::typeId<T>();
+      }
+      else
+      {
+        static const auto id = internTypeId(type_hash<T>(), type_name<T>());
+        return id;
+      }
     }
 
-    using F = void (*)(void*, const void*);
-    F func;
+    template<auto Method>
+    static Hash methodId()
+    {
+      return typeId<TemplateParameter<Method>>();
+    }
   };
 
-  struct ObjectFunctionView
+  template<typename T, typename TypeIds, typename A>
+  constexpr auto collectBaseHashesInt(A& hashes, size_t i)
   {
-    template<auto Method>
-    ObjectFunctionView(Class<Method>& i_object, TemplateParameter<Method>):
-            object(static_cast<void*>(&i_object)),
-            fv(TemplateParameter<Method>())
+    hashes[--i] = TypeIds::template typeId<T>(); // корень
+    if constexpr (HasBaseMember<T>::value)
     {
+      collectBaseHashesInt<typename T::Base, TypeIds>(hashes, i);
     }
+  }
+
+  template<typename T, typename TypeIds = AddressTypeIds>
+  constexpr auto collectBaseHashes()
+  {
+    std::array<Hash, countBaseClasses<T>()> hashes{};
+    collectBaseHashesInt<T, TypeIds>(hashes, hashes.size());
+    return hashes;
+  }
 
-    inline void invoke(const void* i_event) const
+  // для AddressTypeIds инициализация константная, проверки guard нет
+  template<typename T, typename TypeIds = AddressTypeIds>
+  const ArrayView2<Hash>& typeInfo()
+  {
+    static const auto hashes = collectBaseHashes<T, TypeIds>();
+    static const ArrayView2<Hash> value{hashes};
+    return value;
+  }
+
+  // хранит статическую цепочку типов самого производного события (как vptr,
+  // но сам view, а не указатель на него: чтение - одна загрузка): при
+  // копировании не переносится, каждый уровень Dispatchable записывает свой
+  // тип в конструкторе
+  struct DynamicTypeInfo
+  {
+    inline ArrayView2<Hash> getDynamicTypeInfo() const
     {
-      fv.func(object, i_event);
+      return dynamicTypeInfo;
     }
 
-    inline const void* getObject() const
+  protected:
+    DynamicTypeInfo() = default;
+
+    DynamicTypeInfo(const DynamicTypeInfo&)
     {
-      return object;
     }
 
-  private:
-    void* object;
-    FunctionView fv;
+    DynamicTypeInfo& operator=(const DynamicTypeInfo&)
+    {
+      return *this;
+    }
+
+    ArrayView2<Hash> dynamicTypeInfo;
   };
 
-  template<typename T>
-  struct Numbered
+  // struct EventBase : Dispatchable<EventBase> {...};
+  // struct Event1 : Dispatchable<Event1, EventBase> {...};
+  // каждый уровень иерархии должен наследоваться через Dispatchable,
+  // иначе InvokerContainer::invokeDynamic доставит событие как ближайший
+  // Dispatchable-предок
+  // политика идентификаторов задается в корне:
+  // struct EventBase : Dispatchable<EventBase, void, StableTypeIds> {...};
+  template<typename Event, typename BaseEvent = void,
+          typename TypeIds = AddressTypeIds>
+  struct Dispatchable : BaseEvent
   {
-    Numbered(const size_t i_pos, const T& i_value): pos(i_pos), value(i_value)
-    {};
-    
-    size_t pos;
-    std::optional<T> value;
-  };
+    using Base = BaseEvent;
 
-  using NumberedFunctionView = Numbered<ObjectFunctionView>;
+    template<typename... Args>
+    Dispatchable(Args&& ... args): BaseEvent(std::forward<Args>(args)...)
+    {
+      this->dynamicTypeInfo =
+              typeInfo<Event, typename BaseEvent::DispatchTypeIds>();
+    }
 
-  struct Handler
-  {
-    template<auto Method>
-    Handler(Class<Method>& i_object, TemplateParameter<Method> method):
-            fv(i_object, method), methodId(ValueHash<Method>)
+    Dispatchable(const Dispatchable& other): BaseEvent(other)
     {
+      this->dynamicTypeInfo =
+              typeInfo<Event, typename BaseEvent::DispatchTypeIds>();
     }
 
-    inline const void* getObject() const
+    Dispatchable& operator=(const Dispatchable&) = default;
+  };
+
+  template<typename Event, typename TypeIds>
+  struct Dispatchable<Event, void, TypeIds> : DynamicTypeInfo
+  {
+    using DispatchTypeIds = TypeIds;
+
+    Dispatchable()
     {
-      return fv.getObject();
+      dynamicTypeInfo = typeInfo<Event, TypeIds>();
     }
 
-    MethodId methodId;
-    std::vector<ArrayView2<TypeId>> notProcessesEvents;
+    Dispatchable(const Dispatchable&): Dispatchable()
+    {
+    }
 
-    ObjectFunctionView fv;
-    size_t pos;
+    Dispatchable& operator=(const Dispatchable&) = default;
   };
 
-  template<auto ... Methods>
-  constexpr bool isSameObjectType()
+  using TypeId = Hash;
+  using MethodId = Hash;
+
+#ifdef HB4_PROFILE_HANDLERS
+  // профилирование обработчиков в SimpleInvoker; без HB4_PROFILE_HANDLERS
+  // цикл доставки не меняется
+
+  // такты процессора (rdtsc) или наносекунды steady_clock
+  inline uint64_t profileTicks()
   {
-    return (std::is_same_v<Class<Methods...>, Class<Methods>> && ...);
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
   }
 
-  template<auto ... Methods>
-  struct Register
+  // снимок счетчиков одного обработчика
+  struct HandlerProfile
   {
-    static_assert(isSameObjectType<Methods...>());
+    const void* object;
+    MethodId methodId;
+    std::string name;
+    uint64_t calls;
+    uint64_t totalTicks;
+    uint64_t maxTicks;
   };
 
-  struct Invoker
+  // счетчики обработчика (объект, метод), общие для всех контейнеров,
+  // где он подключен; после отключения последнего обработчика запись
+  // обнуляется и переиспользуется
+  struct HandlerProfileRecord
   {
-    inline void append(const Handler& i_handlerItem)
-    {
-      handlers.push_back(i_handlerItem);
-    }
-
-    inline bool isObjectExists(const void* i_object) const
-    {
-      return std::find_if(begin(handlers), end(handlers),
-                          [i_object](const auto& i_handler)
-                          {
-                            return i_handler.has_value() &&
-                                   i_handler->getObject() == i_object;
-                          }) != end(handlers);
-    }
-
-    void setNotProcessedEvents(const void* i_object,
-                               std::vector<ArrayView2<Hash>>&& notProcessedEvents)
+    inline void record(const uint64_t i_ticks)
     {
-      for (auto& handler: handlers)
+      calls.fetch_add(1, std::memory_order_relaxed);
+      totalTicks.fetch_add(i_ticks, std::memory_order_relaxed);
+      auto max = maxTicks.load(std::memory_order_relaxed);
+      while (i_ticks > max &&
+             !maxTicks.compare_exchange_weak(max, i_ticks,
+                                             std::memory_order_relaxed))
       {
-        if (handler.has_value() && handler->getObject() == i_object)
-        {
-          handler->notProcessesEvents = std::move(notProcessedEvents);
-        }
       }
     }
 
-    template<typename F>
-    inline size_t removeIf(const void* object, F shouldRemove)
-    {
-      size_t disconnected = 0;
-      for (auto& handler: handlers)
-      {
-        if (handler.has_value() &&
-            handler->getObject() == object &&
-            shouldRemove(*handler))
-        {
-          handler.reset();
-          ++disconnected;
-        }
-      }
-      dirty = disconnected > 0;
-      removeEmpty();
-      return disconnected;
-    }
+    const void* object;
+    MethodId methodId;
+    // копия: имя из выгруженной библиотеки не должно повиснуть
+    std::string name;
+    // число подключенных обработчиков с этой записью
+    size_t handlers = 0;
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> totalTicks{0};
+    std::atomic<uint64_t> maxTicks{0};
+  };
 
-    size_t disconnect(const void* object);
-    size_t disconnect(const void* object, const MethodId methodHash);
+  // запись для нового обработчика; ее освобождает releaseProfileRecord
+  HandlerProfileRecord* profileRecord(const void* object, MethodId methodId,
+                                      std::string_view name);
+  void releaseProfileRecord(HandlerProfileRecord* record);
+  // только подключенные обработчики
+  std::vector<HandlerProfile> profileSnapshot();
+  // обработчики по убыванию суммарного времени
+  std::string profileReport();
+  void resetProfile();
+#endif
+
+#ifdef HB4_TRACE_DISPATCH
+  // трасса доставки для Perfetto (формат Chrome Trace Event): начало и конец
+  // доставки события в InvokerContainerImpl::invoke и вызова каждого
+  // обработчика списка доставки. Каждый поток пишет в свой кольцевой буфер,
+  // в трассу попадает одна доставка верхнего уровня из N вместе со всеми
+  // вложенными; без HB4_TRACE_DISPATCH код доставки не меняется
+
+  // копия имени, живущая до конца программы: имя из выгруженной
+  // библиотеки не должно повиснуть в трассе
+  const std::string* internTraceName(std::string_view name);
+
+  struct TraceRecord
+  {
+    uint64_t ticks;
+    // имя типа события или обработчика; если имя неизвестно, пишется id
+    const std::string* name;
+    Hash id;
+    bool isHandler;
+    // 'B' - начало, 'E' - конец
+    char phase;
+  };
 
-    inline bool isEmpty() const
+  // старые записи затираются новыми; пишет один поток, читает
+  // flushTraceJson из любого
+  struct TraceBuffer
+  {
+    static constexpr size_t capacity = size_t(1) << 14;
+
+    inline void record(const TraceRecord& i_record)
     {
-      return handlers.empty();
+      const auto n = next.load(std::memory_order_relaxed);
+      records[n % capacity] = i_record;
+      next.store(n + 1, std::memory_order_release);
     }
 
-    std::vector<std::optional<Handler>> handlers;
-
-  private:
-    void removeEmpty();
-
-    bool isInInvokeProcess = false;
-    bool dirty = false;
+    std::vector<TraceRecord> records = std::vector<TraceRecord>(capacity);
+    std::atomic<size_t> next{0};
+    // дальше - под мьютексом трассы
+    // записи до flushed уже попали в трассу
+    size_t flushed = 0;
+    uint64_t threadId = 0;
+    // поток завершился; после сброса записей буфер переиспользуется
+    bool retired = false;
   };
 
-  struct SimpleInvoker
+  TraceBuffer& registerTraceBuffer();
+  void releaseTraceBuffer(TraceBuffer& buffer);
+
+  struct TraceThread
   {
-    explicit SimpleInvoker()
+    // создается при первой записи, при завершении потока возвращается
+    // для переиспользования
+    ~TraceThread()
     {
+      if (buffer)
+      {
+        releaseTraceBuffer(*buffer);
+      }
     }
 
-    inline void append(const size_t i_pos, const ObjectFunctionView& i_function)
+    TraceBuffer* buffer = nullptr;
+    uint32_t dispatches = 0;
+    uint32_t depth = 0;
+    bool sampled = false;
+  };
+
+  inline std::atomic<uint32_t> traceEveryN{0};
+  inline thread_local TraceThread traceThread;
+
+  inline void traceRecord(const std::string* i_name, const Hash i_id,
+                          const bool i_isHandler, const char i_phase)
+  {
+    auto& thread = traceThread;
+    if (!thread.buffer)
     {
-      functions.emplace_back(i_pos, i_function);
+      thread.buffer = &registerTraceBuffer();
     }
+    thread.buffer->record(TraceRecord{LatencyHistogram::now(), i_name, i_id,
+                                      i_isHandler, i_phase});
+  }
 
-    void invoke(const void* event)
+  // доставка события; решение о выборке принимается на верхнем уровне потока
+  struct TraceDispatchScope
+  {
+    TraceDispatchScope(const std::string_view i_name, const Hash i_id)
+            : id(i_id)
     {
-      const auto firstLevel = !isInInvokeProcess;
-      isInInvokeProcess = true;
-      // нельзя использовать range for
-      // при увеличении длины массива handlers он может быть перенесен в другое
-      // место в памяти и все итераторы станут невалидными
-      for (size_t i = 0; i < functions.size(); ++i)
+      auto& thread = traceThread;
+      if (thread.depth++ == 0)
       {
-        const auto& function = functions[i];
-        if (function.value.has_value())
-        {
-          function.value->invoke(event);
-        }
+        const auto everyN = traceEveryN.load(std::memory_order_relaxed);
+        thread.sampled = everyN != 0 && ++thread.dispatches % everyN == 0;
       }
-      if (firstLevel)
+      if (thread.sampled)
       {
-        isInInvokeProcess = false;
-        removeEmpty();
+        // имя копируется только для доставок из выборки
+        name = i_name.empty() ? nullptr : internTraceName(i_name);
+        traceRecord(name, id, false, 'B');
       }
     }
 
-    inline size_t disconnect(const void* object)
+    ~TraceDispatchScope()
     {
-      size_t disconnected = 0;
-      for (auto& [pos, function]: functions)
+      auto& thread = traceThread;
+      if (thread.sampled)
       {
-        if (function.has_value() && function->getObject() == object)
-        {
-          function.reset();
-          ++disconnected;
-        }
+        traceRecord(name, id, false, 'E');
+      }
+      if (--thread.depth == 0)
+      {
+        thread.sampled = false;
       }
-      dirty = disconnected > 0;
-      removeEmpty();
-      return disconnected;
     }
 
-    inline bool isEmpty() const
+    TraceDispatchScope(const TraceDispatchScope&) = delete;
+    TraceDispatchScope& operator=(const TraceDispatchScope&) = delete;
+
+  private:
+    const std::string* name = nullptr;
+    Hash id;
+  };
+
+  // вызов обработчика; пишется, только если доставка попала в выборку
+  struct TraceHandlerScope
+  {
+    TraceHandlerScope(const std::string* i_name, const Hash i_id)
+            : sampled(traceThread.sampled), name(i_name), id(i_id)
     {
-      return functions.empty();
+      if (sampled)
+      {
+        traceRecord(name, id, true, 'B');
+      }
     }
 
-    inline void sort()
+    ~TraceHandlerScope()
     {
-      std::sort(begin(functions), end(functions),
-                [](const auto& left, const auto& right)
-                {
-                  return left.pos < right.pos;
-                });
+      if (sampled)
+      {
+        traceRecord(name, id, true, 'E');
+      }
     }
 
-    std::vector<NumberedFunctionView> functions;
+    TraceHandlerScope(const TraceHandlerScope&) = delete;
+    TraceHandlerScope& operator=(const TraceHandlerScope&) = delete;
 
   private:
-    void removeEmpty();
-
-    bool isInInvokeProcess = false;
-    bool dirty = false;
+    bool sampled;
+    const std::string* name;
+    Hash id;
   };
 
-  struct EventMethodType
+  // 0 - трасса выключена, 1 - каждая доставка, N - одна из N в каждом потоке
+  inline void setTraceSampling(const uint32_t i_everyN)
   {
-    TypeId event;
-    MethodId method;
-  };
+    traceEveryN.store(i_everyN, std::memory_order_relaxed);
+  }
 
-  inline bool isBaseOf(const ShortTypeInfo i_base,
-                       const ArrayView2<TypeId> i_derived)
-  {
-    return !i_base.empty() &&
-           i_derived.size() > i_base.depthOfInheritance &&
-           i_base.typeId == i_derived[i_base.depthOfInheritance - 1];
-  };
+  // трасса всех потоков в формате Chrome Trace Event JSON; в нее попадают
+  // записи, появившиеся после прошлого вызова. Можно вызывать во время
+  // доставки в других потоках: записи, затертые потоком во время чтения,
+  // отбрасываются
+  std::string flushTraceJson();
+#endif
 
-  template<typename T>
-  struct TreeNode
+  struct ShortTypeInfo
   {
-    T value;
-    std::vector<TreeNode<T>> subTree;
-  };
+    constexpr ShortTypeInfo(ArrayView2<TypeId> i_TypeInfo) : typeId(
+            i_TypeInfo.back()), depthOfInheritance(i_TypeInfo.size())
+    {
+    }
 
-  struct EventHandlers
-  {
-    ArrayView2<TypeId> eventTypeInfo;
-    std::vector<Handler*> handlers;
-  };
+    constexpr inline bool empty() const
+    {
+      return depthOfInheritance == 0;
+    }
 
-  using EventHandlersTreeNode = TreeNode<EventHandlers>;
+    TypeId typeId;
+    size_t depthOfInheritance;
+  };
 
-  struct ObjectHandlers
+  // арифметический результат обработчика, тип которого не совпал
+  // с Value коллектора; заполнено одно поле по kind
+  struct NumericResult
   {
-    
-    void* object;
+    enum class Kind
+    {
+      Signed,
+      Unsigned,
+      Floating
+    };
+
+    Kind kind;
+    long long asSigned = 0;
+    unsigned long long asUnsigned = 0;
+    long double asFloating = 0;
   };
 
-
-  struct InvokerContainerImpl
+  template<typename T>
+  constexpr NumericResult toNumericResult(const T i_value)
   {
-    inline void registerType(const ArrayView2<TypeId> typeInfo)
+    NumericResult result{NumericResult::Kind::Floating};
+    if constexpr (std::is_floating_point_v<T>)
     {
-      eventTypes.try_emplace(typeInfo.back(),
-                             std::vector<TypeId>{typeInfo.begin(),
-                                                 typeInfo.end()});
+      result.asFloating = i_value;
     }
-
-    inline void connect(const ArrayView2<TypeId> eventType, Handler handler)
+    else if constexpr (std::is_signed_v<T>)
     {
-      handler.pos = pos++;
-      invokers[eventType.back()].append(handler);
-      registerType(eventType);
-      updateDependencies(handler.getObject());
-      simpleInvokersUpdated = false;
+      result.kind = NumericResult::Kind::Signed;
+      result.asSigned = i_value;
     }
-
-    inline ArrayView2<TypeId> getTypeInfo(const TypeId i_typeId)
+    else
     {
-      const auto it = eventTypes.find(i_typeId);
-      return it == end(eventTypes) ? ArrayView2<TypeId>() : it->second;
+      result.kind = NumericResult::Kind::Unsigned;
+      result.asUnsigned = i_value;
     }
+    return result;
+  }
 
-    inline EventHandlersTreeNode* updateTreeFrom(
-            std::vector<EventHandlersTreeNode>& result,
-            const ArrayView2<TypeId> newTypeInfo, Handler& handler)
+  // принимает результаты обработчиков при InvokerContainer::invoke(event,
+  // collector). Результат типа Value передается в accept, арифметический
+  // результат другого типа приводится к Value (acceptNumeric, если Value
+  // арифметический), остальные результаты другого типа считаются в
+  // mismatched. bool и HandleResult - признак поглощения, а не результат:
+  // при несовпадении типа они не передаются и не считаются.
+  // Коллектор доставку не прекращает, это делает только поглощение
+  struct ResultSink
+  {
+    TypeId resultType;
+    void* collector;
+    void (*accept)(void* collector, const void* value);
+    void (*acceptNumeric)(void* collector, const NumericResult& value);
+    size_t mismatched = 0;
+  };
+
+  // возвращает true, если обработчик поглотил событие
+  template<typename R, typename TypeIds, typename Call>
+  inline bool callHandler(Call call, ResultSink* sink)
+  {
+    if constexpr (std::is_void_v<R>)
+    {
+      call();
+      return false;
+    }
+    else
+    {
+      const R result = call();
+      bool consumed = false;
+      if constexpr (IsConsumingResult<R>)
+      {
+        consumed = isConsumed(result);
+      }
+      if (!sink)
+      {
+        return consumed;
+      }
+      using Value = std::decay_t<R>;
+      if (sink->resultType == TypeIds::template typeId<Value>())
+      {
+        sink->accept(sink->collector, &result);
+      }
+      else if constexpr (!IsConsumingResult<R>)
+      {
+        if constexpr (std::is_arithmetic_v<Value>)
+        {
+          if (sink->acceptNumeric)
+          {
+            sink->acceptNumeric(sink->collector, toNumericResult(result));
+            return consumed;
+          }
+        }
+        ++sink->mismatched;
+      }
+      return consumed;
+    }
+  }
+
+  // непрерывный набор однотипных объектов, подключенный одним обработчиком;
+  // stride - расстояние между объектами в байтах
+  template<typename T>
+  struct ObjectRange
+  {
+    T* base;
+    size_t count;
+    size_t stride;
+  };
+
+  struct FunctionView
+  {
+    // пустой обработчик
+    FunctionView(): func(&FunctionView::skip)
+    {
+    }
+
+    template<auto Method, typename TypeIds>
+    FunctionView(TemplateParameter<Method>, TypeIds):
+            func([](void* object, const void* event, ResultSink* sink)
+                 {
+                   return callHandler<Result<Method>, TypeIds>([object, event]()
+                   {
+                     return (static_cast<Class<Method>*>(object)->*Method)(
+                             *static_cast<const Argument<Method>*>(event));
+                   }, sink);
+                 })
+    {
+    }
+
+    // один косвенный вызов на весь набор, внутри - прямой вызов метода
+    template<auto Method, typename TypeIds>
+    FunctionView(TemplateParameter<Method>,
+                 TemplateType<ObjectRange<Class<Method>>>, TypeIds):
+            func([](void* object, const void* event, ResultSink* sink)
+                 {
+                   // копия: resize из обработчика набора не смешивает старое
+                   // начало с новым количеством
+                   const auto range =
+                           *static_cast<const ObjectRange<Class<Method>>*>(object);
+                   const auto& argument =
+                           *static_cast<const Argument<Method>*>(event);
+                   auto* data = reinterpret_cast<unsigned char*>(range.base);
+                   for (size_t i = 0; i < range.count; ++i)
+                   {
+                     auto* item = reinterpret_cast<Class<Method>*>(
+                             data + i * range.stride);
+                     if (callHandler<Result<Method>, TypeIds>([item, &argument]()
+                     {
+                       return (item->*Method)(argument);
+                     }, sink))
+                     {
+                       return true;
+                     }
+                   }
+                   return false;
+                 })
+    {
+    }
+
+    template<typename Functor, typename TypeIds>
+    FunctionView(TemplateType<Functor>, TypeIds):
+            func([](void* object, const void* event, ResultSink* sink)
+                 {
+                   return callHandler<CallableResult<Functor>, TypeIds>(
+                           [object, event]()
+                           {
+                             return (*static_cast<Functor*>(object))(
+                                     *static_cast<const CallableArgument<Functor>*>(event));
+                           }, sink);
+                 })
+    {
+    }
+
+    using F = bool (*)(void*, const void*, ResultSink*);
+    F func;
+
+    // подставляется вместо обработчика, отключенного во время доставки
+    static bool skip(void*, const void*, ResultSink*)
+    {
+      return false;
+    }
+  };
+
+  struct ObjectFunctionView
+  {
+    // пустой обработчик, как после disable()
+    ObjectFunctionView(): object(nullptr)
+    {
+    }
+
+    template<auto Method, typename TypeIds>
+    ObjectFunctionView(Class<Method>& i_object, TemplateParameter<Method> method,
+                       TypeIds typeIds):
+            object(static_cast<void*>(&i_object)),
+            fv(method, typeIds)
+    {
+    }
+
+    template<auto Method, typename TypeIds>
+    ObjectFunctionView(ObjectRange<Class<Method>>& i_range,
+                       TemplateParameter<Method> method, TypeIds typeIds):
+            object(static_cast<void*>(&i_range)),
+            fv(method, TemplateType<ObjectRange<Class<Method>>>(), typeIds)
+    {
+    }
+
+    template<typename Functor, typename TypeIds>
+    ObjectFunctionView(Functor& i_functor, TemplateType<Functor> functor,
+                       TypeIds typeIds):
+            object(static_cast<void*>(&i_functor)),
+            fv(functor, typeIds)
+    {
+    }
+
+    inline bool invoke(const void* i_event, ResultSink* i_sink) const
+    {
+      return fv.func(object, i_event, i_sink);
+    }
+
+    inline const void* getObject() const
+    {
+      return object;
+    }
+
+    inline FunctionView::F getFunction() const
+    {
+      return fv.func;
+    }
+
+    inline void disable()
+    {
+      object = nullptr;
+      fv.func = &FunctionView::skip;
+    }
+
+    inline bool isDisabled() const
+    {
+      return fv.func == &FunctionView::skip;
+    }
+
+  private:
+    void* object;
+    FunctionView fv;
+  };
+
+  // группа обработчиков, которую можно выключить без переподключения
+  // (setGroupEnabled); не более 64 групп
+  struct Group
+  {
+    uint8_t id;
+  };
+
+  // бит группы обработчика, 0 - обработчик вне групп
+  using GroupMask = uint64_t;
+
+  // обработчики с большим приоритетом вызываются раньше,
+  // с равным - в порядке подключения
+  struct Priority
+  {
+    int value;
+  };
+
+  // дополнительные параметры connect: ic.connect<&H::on>(h, {group, Priority{1}})
+  struct ConnectOptions
+  {
+    ConnectOptions() = default;
+
+    ConnectOptions(const Group i_group): group(i_group)
+    {
+    }
+
+    ConnectOptions(const Priority i_priority): priority(i_priority.value)
+    {
+    }
+
+    ConnectOptions(const Group i_group, const Priority i_priority):
+            group(i_group), priority(i_priority.value)
+    {
+    }
+
+    std::optional<Group> group;
+    int priority = 0;
+  };
+
+  inline GroupMask groupMask(const std::optional<Group> i_group)
+  {
+    if (!i_group)
+    {
+      return 0;
+    }
+    if (i_group->id >= std::numeric_limits<GroupMask>::digits)
+    {
+      throw std::invalid_argument("HB4: group id must be less than 64");
+    }
+    return GroupMask(1) << i_group->id;
+  }
+
+  // элемент списка доставки
+  struct DispatchFunction
+  {
+    inline bool invoke(const void* i_event, ResultSink* i_sink) const
+    {
+#if defined(HB4_PROFILE_HANDLERS) || defined(HB4_TRACE_DISPATCH)
+      if (fv.isDisabled())
+      {
+        return false;
+      }
+#endif
+#ifdef HB4_TRACE_DISPATCH
+      const TraceHandlerScope traceScope(name, methodId);
+#endif
+#ifdef HB4_PROFILE_HANDLERS
+      const auto begin = profileTicks();
+      const auto result = fv.invoke(i_event, i_sink);
+      profile->record(profileTicks() - begin);
+      return result;
+#else
+      return fv.invoke(i_event, i_sink);
+#endif
+    }
+
+    inline const void* getObject() const
+    {
+      return fv.getObject();
+    }
+
+    ObjectFunctionView fv;
+    MethodId methodId;
+    GroupMask groups;
+#ifdef HB4_PROFILE_HANDLERS
+    HandlerProfileRecord* profile;
+#endif
+#ifdef HB4_TRACE_DISPATCH
+    const std::string* name;
+#endif
+  };
+
+  struct Handler
+  {
+    template<auto Method, typename TypeIds>
+    Handler(Class<Method>& i_object, TemplateParameter<Method> method,
+            TypeIds typeIds, const ConnectOptions& i_options = {}):
+            methodId(TypeIds::template methodId<Method>()),
+            fv(i_object, method, typeIds),
+            consumes(IsConsumingResult<Result<Method>>),
+            groups(groupMask(i_options.group)),
+            priority(i_options.priority)
+    {
+#ifdef HB4_PROFILE_HANDLERS
+      profile = profileRecord(&i_object, methodId, value_name<Method>());
+#endif
+#ifdef HB4_TRACE_DISPATCH
+      name = internTraceName(value_name<Method>());
+#endif
+    }
+
+    template<auto Method, typename TypeIds>
+    Handler(ObjectRange<Class<Method>>& i_range, TemplateParameter<Method> method,
+            TypeIds typeIds, const ConnectOptions& i_options = {}):
+            methodId(TypeIds::template methodId<Method>()),
+            fv(i_range, method, typeIds),
+            consumes(IsConsumingResult<Result<Method>>),
+            groups(groupMask(i_options.group)),
+            priority(i_options.priority)
+    {
+#ifdef HB4_PROFILE_HANDLERS
+      profile = profileRecord(&i_range, methodId, value_name<Method>());
+#endif
+#ifdef HB4_TRACE_DISPATCH
+      name = internTraceName(value_name<Method>());
+#endif
+    }
+
+    template<typename Functor, typename TypeIds>
+    Handler(Functor& i_functor, TemplateType<Functor> functor,
+            TypeIds typeIds, const ConnectOptions& i_options = {}):
+            methodId(TypeIds::template typeId<Functor>()),
+            fv(i_functor, functor, typeIds),
+            consumes(IsConsumingResult<CallableResult<Functor>>),
+            groups(groupMask(i_options.group)),
+            priority(i_options.priority)
+    {
+#ifdef HB4_PROFILE_HANDLERS
+      profile = profileRecord(&i_functor, methodId, type_name<Functor>());
+#endif
+#ifdef HB4_TRACE_DISPATCH
+      name = internTraceName(type_name<Functor>());
+#endif
+    }
+
+    // копия, массив скрытых типов которой размещается в i_resource
+    Handler(const Handler& i_other, std::pmr::memory_resource* i_resource):
+            Handler(i_other)
+    {
+      // присваивание не меняет распределитель: массив пересоздается
+      // переносом (noexcept) копии, уже размещенной в i_resource
+      NotProcessesEvents events(i_other.notProcessesEvents, i_resource);
+      std::destroy_at(&notProcessesEvents);
+      new (&notProcessesEvents) NotProcessesEvents(std::move(events));
+    }
+
+    inline const void* getObject() const
+    {
+      return fv.getObject();
+    }
+
+    using NotProcessesEvents = SmallVector<ArrayView2<TypeId>, 2,
+            std::pmr::polymorphic_allocator<ArrayView2<TypeId>>>;
+
+    MethodId methodId;
+    // обычно пуст или из одного-двух типов: без выделения памяти
+    NotProcessesEvents notProcessesEvents;
+
+    ObjectFunctionView fv;
+    // возвращает bool или HandleResult и может остановить доставку
+    bool consumes;
+    GroupMask groups;
+    int priority;
+    size_t pos;
+#ifdef HB4_PROFILE_HANDLERS
+    HandlerProfileRecord* profile;
+#endif
+#ifdef HB4_TRACE_DISPATCH
+    const std::string* name;
+#endif
+  };
+
+  // обработчик: объект и его метод (или функтор)
+  struct HandlerKey
+  {
+    const void* object;
+    MethodId methodId;
+
+    inline bool operator==(const HandlerKey& other) const
+    {
+      return object == other.object && methodId == other.methodId;
+    }
+  };
+
+  struct HandlerKeyHash
+  {
+    inline size_t operator()(const HandlerKey& i_key) const
+    {
+      return std::hash<const void*>()(i_key.object) ^
+             std::hash<const void*>()(i_key.methodId);
+    }
+  };
+
+  // before вызывается раньше after, если оба попали в один список доставки
+  struct HandlerOrdering
+  {
+    HandlerKey before;
+    HandlerKey after;
+  };
+
+  // упорядочивает обработчики одного списка доставки по приоритету и позиции
+  // подключения с учетом ограничений (топологическая сортировка);
+  // вызывается только при построении списков
+  void orderHandlers(std::pmr::vector<const Handler*>& handlers,
+                     const std::pmr::vector<HandlerOrdering>& orderings);
+
+  // порядок не важен: подряд идут обработчики с одной функцией-переходником,
+  // и косвенный переход в цикле доставки предсказывается лучше
+  void groupHandlersByFunction(std::pmr::vector<const Handler*>& handlers);
+
+  // бросает std::logic_error, если новое ограничение замыкает цикл
+  void checkOrdering(const std::pmr::vector<HandlerOrdering>& orderings,
+                     const HandlerOrdering& ordering);
+
+  template<auto ... Methods>
+  constexpr bool isSameObjectType()
+  {
+    return (std::is_same_v<Class<Methods...>, Class<Methods>> && ...);
+  }
+
+  template<auto ... Methods>
+  struct Register
+  {
+    static_assert(isSameObjectType<Methods...>());
+  };
+
+  // перенос при росте массива не должен копировать notProcessesEvents
+  // в ресурс по умолчанию
+  static_assert(std::is_nothrow_move_constructible_v<Handler>);
+
+  struct Invoker
+  {
+    using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
+    Invoker() = default;
+
+    explicit Invoker(const allocator_type& i_allocator) : handlers(i_allocator)
+    {
+    }
+
+#ifdef HB4_PROFILE_HANDLERS
+    // хранимые обработчики владеют записями профиля
+    Invoker(const Invoker&) = delete;
+    Invoker& operator=(const Invoker&) = delete;
+    ~Invoker();
+#endif
+
+    // возвращает индекс обработчика в handlers
+    inline size_t append(const Handler& i_handlerItem)
+    {
+      handlers.emplace_back(std::in_place, i_handlerItem,
+                            handlers.get_allocator().resource());
+      prioritized += i_handlerItem.priority != 0;
+      return handlers.size() - 1;
+    }
+
+    // обработчик с позицией i_pos, подключенный по индексу i_index;
+    // уплотнение сдвигает обработчики только к началу и сохраняет
+    // возрастание pos
+    inline const Handler* find(const size_t i_index, const size_t i_pos) const
+    {
+      if (i_index < handlers.size() && handlers[i_index].has_value() &&
+          handlers[i_index]->pos == i_pos)
+      {
+        return &*handlers[i_index];
+      }
+      const auto last = begin(handlers) +
+                        static_cast<ptrdiff_t>(std::min(i_index, handlers.size()));
+      const auto it = std::lower_bound(begin(handlers), last, i_pos,
+                                       [](const auto& handler, const size_t pos)
+                                       {
+                                         return handler->pos < pos;
+                                       });
+      return it != last && (*it)->pos == i_pos ? &**it : nullptr;
+    }
+
+    void setNotProcessedEvents(const void* i_object,
+                               const ArrayView2<ArrayView2<Hash>> notProcessedEvents)
+    {
+      for (auto& handler: handlers)
+      {
+        if (handler.has_value() && handler->getObject() == i_object)
+        {
+          handler->notProcessesEvents.assign(notProcessedEvents.begin(),
+                                             notProcessedEvents.end());
+        }
+      }
+    }
+
+    template<typename F>
+    inline size_t removeIf(const void* object, F shouldRemove)
+    {
+      size_t disconnected = 0;
+      for (auto& handler: handlers)
+      {
+        if (handler.has_value() &&
+            handler->getObject() == object &&
+            shouldRemove(*handler))
+        {
+          prioritized -= handler->priority != 0;
+#ifdef HB4_PROFILE_HANDLERS
+          releaseProfileRecord(handler->profile);
+#endif
+          handler.reset();
+          ++disconnected;
+        }
+      }
+      dirty = disconnected > 0;
+      removeEmpty();
+      return disconnected;
+    }
+
+    size_t disconnect(const void* object);
+    size_t disconnect(const void* object, const MethodId methodHash);
+
+    inline bool isEmpty() const
+    {
+      return handlers.empty();
+    }
+
+    std::pmr::vector<std::optional<Handler>> handlers;
+    // статистика контейнера-владельца, если она ведется
+    StructureStats* stats = nullptr;
+    // число обработчиков с ненулевым приоритетом
+    size_t prioritized = 0;
+
+  private:
+    void removeEmpty();
+
+    bool isInInvokeProcess = false;
+    bool dirty = false;
+  };
+
+  // задержки доставки одного типа события; на замеренную доставку два
+  // чтения счетчика тактов
+  struct DispatchLatency
+  {
+    // копия: имя из выгруженной библиотеки не должно повиснуть
+    std::string name;
+    // InvokerContainerImpl::invoke без перестроения списков, одна из
+    // latencySampling доставок
+    LatencyHistogram dispatch;
+    // доставки, перед которыми перестраивались списки: перестроение
+    // вместе с доставкой
+    LatencyHistogram rebuild;
+  };
+
+  // гистограммы по типам событий; отчеты разных контейнеров сливаются merge
+  struct LatencyReport
+  {
+    DispatchLatency& get(const TypeId i_eventTypeId,
+                         const std::string_view i_name);
+    void merge(const LatencyReport& i_other);
+    // {"<тип>":{"dispatch":{...},"rebuild":{...}},...}, время в наносекундах
+    std::string toJson() const;
+
+    std::unordered_map<TypeId, std::unique_ptr<DispatchLatency>> eventTypes;
+  };
+
+  // вызывает i_onExit при выходе из области видимости, в том числе при
+  // исключении из обработчика: флаги доставки не остаются взведенными
+  template<typename F>
+  struct ScopeExit
+  {
+    explicit ScopeExit(F i_onExit): onExit(std::move(i_onExit))
+    {
+    }
+
+    ~ScopeExit()
+    {
+      onExit();
+    }
+
+    ScopeExit(const ScopeExit&) = delete;
+    ScopeExit& operator=(const ScopeExit&) = delete;
+
+    F onExit;
+  };
+
+  struct SimpleInvoker
+  {
+    using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
+    explicit SimpleInvoker()
+    {
+    }
+
+    explicit SimpleInvoker(const allocator_type& i_allocator)
+            : functions(i_allocator)
+    {
+    }
+
+    inline void append(const Handler& i_handler)
+    {
+      functions.push_back(DispatchFunction{i_handler.fv, i_handler.methodId,
+                                           i_handler.groups
+#ifdef HB4_PROFILE_HANDLERS
+                                           , i_handler.profile
+#endif
+#ifdef HB4_TRACE_DISPATCH
+                                           , i_handler.name
+#endif
+      });
+      consumes = consumes || i_handler.consumes;
+    }
+
+    // возвращает true, если событие поглощено;
+    // обработчики выключенных групп (mutedGroups) пропускаются
+    bool invoke(const void* event, ResultSink* sink = nullptr,
+                const GroupMask mutedGroups = 0)
+    {
+      const auto firstLevel = !isInInvokeProcess;
+      isInInvokeProcess = true;
+      const ScopeExit invokeExit([this, firstLevel]()
+                                 {
+                                   isInInvokeProcess = isInInvokeProcess &&
+                                                       !firstLevel;
+                                 });
+      // без поглощающих обработчиков цикл не проверяет результат вызова
+      const auto consumed = consumes ?
+                            invokeFunctions<true>(event, sink, mutedGroups) :
+                            invokeFunctions<false>(event, sink, mutedGroups);
+      if (firstLevel)
+      {
+        isInInvokeProcess = false;
+        removeEmpty();
+      }
+      return consumed;
+    }
+
+    inline bool isInvoking() const
+    {
+      return isInInvokeProcess;
+    }
+
+    inline void clear()
+    {
+      functions.clear();
+      consumes = false;
+    }
+
+    // отключенные обработчики сразу заменяются пустой функцией, поэтому
+    // текущая доставка их уже не вызывает; из массива они удаляются
+    // после доставки
+    inline size_t disconnect(const void* object)
+    {
+      return disableIf([object](const auto& function)
+                       {
+                         return function.getObject() == object;
+                       });
+    }
+
+    inline size_t disconnect(const void* object, const MethodId methodId)
+    {
+      return disableIf([object, methodId](const auto& function)
+                       {
+                         return function.getObject() == object &&
+                                function.methodId == methodId;
+                       });
+    }
+
+    inline bool isEmpty() const
+    {
+      return functions.empty();
+    }
+
+    std::pmr::vector<DispatchFunction> functions;
+    // гистограммы типа, если они включены
+    DispatchLatency* latency = nullptr;
+    // статистика контейнера-владельца, если она ведется
+    StructureStats* stats = nullptr;
+
+  private:
+    template<bool Consumes>
+    inline bool invokeFunctions(const void* event, ResultSink* sink,
+                                const GroupMask mutedGroups)
+    {
+      // нельзя использовать range for
+      // при увеличении длины массива handlers он может быть перенесен в другое
+      // место в памяти и все итераторы станут невалидными
+      for (size_t i = 0; i < functions.size(); ++i)
+      {
+        const auto& function = functions[i];
+        if ((function.groups & mutedGroups) == 0 &&
+            function.invoke(event, sink) && Consumes)
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    template<typename F>
+    inline size_t disableIf(F shouldDisable)
+    {
+      size_t disconnected = 0;
+      for (auto& function: functions)
+      {
+        if (!function.fv.isDisabled() && shouldDisable(function))
+        {
+          function.fv.disable();
+          ++disconnected;
+        }
+      }
+      dirty = dirty || disconnected > 0;
+      removeEmpty();
+      return disconnected;
+    }
+
+    void removeEmpty();
+
+    bool consumes = false;
+
+    bool isInInvokeProcess = false;
+    bool dirty = false;
+  };
+
+  struct EventMethodType
+  {
+    TypeId event;
+    MethodId method;
+  };
+
+  inline bool isBaseOf(const ShortTypeInfo i_base,
+                       const ArrayView2<TypeId> i_derived)
+  {
+    return !i_base.empty() &&
+           i_derived.size() > i_base.depthOfInheritance &&
+           i_base.typeId == i_derived[i_base.depthOfInheritance - 1];
+  };
+
+  // временное дерево типов одного объекта, строится в арене
+  template<typename T>
+  struct TreeNode
+  {
+    T value;
+    std::pmr::vector<TreeNode<T>> subTree;
+  };
+
+  struct EventHandlers
+  {
+    ArrayView2<TypeId> eventTypeInfo;
+    std::pmr::vector<Handler*> handlers;
+  };
+
+  using EventHandlersTreeNode = TreeNode<EventHandlers>;
+
+  struct ObjectHandlers
+  {
+    
+    void* object;
+  };
+
+
+  struct InvokerContainerImpl
+  {
+    // таблицы обработчиков и списки доставки размещаются в i_resource
+    explicit InvokerContainerImpl(std::pmr::memory_resource* i_resource =
+            std::pmr::get_default_resource());
+
+    inline std::pmr::memory_resource* getMemoryResource() const
+    {
+      return invokers.get_allocator().resource();
+    }
+
+    inline void registerType(const ArrayView2<TypeId> typeInfo)
+    {
+      eventTypes.try_emplace(typeInfo.back(), typeInfo.begin(), typeInfo.end());
+    }
+
+    // списки доставки не перестраиваются целиком: обработчик дописывается
+    // в готовые списки на границе следующей доставки (applyPendingChanges)
+    inline void connect(const ArrayView2<TypeId> eventType, Handler handler)
+    {
+      handler.pos = pos++;
+      const auto objectExists = ++objectHandlers[handler.getObject()] > 1;
+      auto& invoker = invokers[eventType.back()];
+      invoker.stats = stats.get();
+      const auto index = invoker.append(handler);
+      registerType(eventType);
+      updateDependencies(handler.getObject());
+      changeSubscribers(eventType.back(), 1);
+      if (objectExists)
+      {
+        // новый обработчик может скрыть обработчики того же объекта
+        // для базовых типов
+        markStale(eventType);
+      }
+      else
+      {
+        pendingHandlers.push_back(
+                PendingHandler{eventType.back(), index, handler.pos});
+      }
+    }
+
+    inline ArrayView2<TypeId> getTypeInfo(const TypeId i_typeId)
+    {
+      const auto it = eventTypes.find(i_typeId);
+      return it == end(eventTypes) ? ArrayView2<TypeId>() : it->second;
+    }
+
+    // узлы дерева создаются в том же ресурсе, что и result
+    inline EventHandlersTreeNode* updateTreeFrom(
+            std::pmr::vector<EventHandlersTreeNode>& result,
+            const ArrayView2<TypeId> newTypeInfo, Handler& handler)
     {
       for (auto& treeNode: result)
       {
-        if (isBaseOf(treeNode.value.eventTypeInfo, newTypeInfo))
+        if (isBaseOf(treeNode.value.eventTypeInfo, newTypeInfo))
+        {
+          return updateTreeFrom(treeNode.subTree, newTypeInfo, handler);
+        }
+        if (isBaseOf(newTypeInfo, treeNode.value.eventTypeInfo))
+        {
+          // перемещенные массивы сохраняют ресурс
+          auto extractedTreeNode = std::move(treeNode);
+          treeNode.value.eventTypeInfo = newTypeInfo;
+          treeNode.value.handlers.clear();
+          treeNode.value.handlers.push_back(&handler);
+          treeNode.subTree.clear();
+          treeNode.subTree.push_back(std::move(extractedTreeNode));
+          // другие потомки нового типа могут стоять только дальше по списку
+          size_t kept = static_cast<size_t>(&treeNode - result.data()) + 1;
+          for (size_t i = kept; i < result.size(); ++i)
+          {
+            if (isBaseOf(newTypeInfo, result[i].value.eventTypeInfo))
+            {
+              treeNode.subTree.push_back(std::move(result[i]));
+            }
+            else
+            {
+              if (kept != i)
+              {
+                result[kept] = std::move(result[i]);
+              }
+              ++kept;
+            }
+          }
+          result.erase(begin(result) + kept, end(result));
+          return &treeNode;
+        }
+        if (newTypeInfo.back() == treeNode.value.eventTypeInfo.back())
+        {
+          treeNode.value.handlers.push_back(&handler);
+          return &treeNode;
+        }
+      }
+      const auto resource = result.get_allocator().resource();
+      result.push_back(EventHandlersTreeNode{
+              EventHandlers{newTypeInfo, std::pmr::vector<Handler*>(resource)},
+              std::pmr::vector<EventHandlersTreeNode>(resource)});
+      result.back().value.handlers.push_back(&handler);
+      return &result.back();
+    }
+
+    inline void updateTreeFrom(std::pmr::vector<EventHandlersTreeNode>& result,
+                               Invoker& invoker, const TypeId eventTypeId,
+                               const void* i_object)
+    {
+      EventHandlersTreeNode* eventHandlersTreeNode = nullptr;
+      for (auto& handler: invoker.handlers)
+      {
+        if (handler.has_value() && handler->getObject() == i_object)
+        {
+          if (eventHandlersTreeNode)
+          {
+            eventHandlersTreeNode->value.handlers.push_back(&*handler);
+          }
+          else
+          {
+            const auto eventTypeInfo = getTypeInfo(eventTypeId);
+            eventHandlersTreeNode =
+                    updateTreeFrom(result, eventTypeInfo, *handler);
+          }
+        }
+      }
+    }
+
+    inline std::pmr::vector<EventHandlersTreeNode> makeInvokersTree(
+            const void* i_object, std::pmr::memory_resource* i_resource)
+    {
+      OperationTimer timer(&stats->makeInvokersTree);
+      std::pmr::vector<EventHandlersTreeNode> result(i_resource);
+      size_t handlersCount = 0;
+      for (auto&[eventTypeId, invoker]: invokers)
+      {
+        updateTreeFrom(result, invoker, eventTypeId, i_object);
+        handlersCount += invoker.handlers.size();
+      }
+      timer.record(handlersCount);
+      return result;
+    }
+
+    inline static std::pmr::vector<ArrayView2<TypeId>> getDirectСhildren(
+            const std::pmr::vector<EventHandlersTreeNode>& i_tree,
+            const ArrayView2<TypeId> eventTypeInfo)
+    {
+      std::pmr::vector<ArrayView2<TypeId>> result(i_tree.get_allocator());
+      for (const auto& node: i_tree)
+      {
+        if (node.value.eventTypeInfo.back() == eventTypeInfo.back())
+        {
+          std::transform(begin(node.subTree), end(node.subTree),
+                         std::back_inserter(result), [](const auto& node)
+                         {
+                           return node.value.eventTypeInfo;
+                         });
+          return result;
+        }
+        if (isBaseOf(node.value.eventTypeInfo, eventTypeInfo))
+        {
+          return getDirectСhildren(node.subTree, eventTypeInfo);
+        }
+      }
+      return result;
+    }
+
+    inline void updateDependencies(std::pmr::vector<EventHandlersTreeNode>& nodes)
+    {
+      for (auto& node: nodes)
+      {
+        const auto directChildren =
+                getDirectСhildren(nodes, node.value.eventTypeInfo);
+        for (auto* handler: node.value.handlers)
+        {
+          handler->notProcessesEvents.assign(begin(directChildren),
+                                             end(directChildren));
+        }
+        updateDependencies(node.subTree);
+      }
+    }
+
+    inline void updateDependencies(const void* i_object)
+    {
+      // дерево живет до конца функции: узлы берутся из арены на стеке,
+      // при ее нехватке - из ресурса контейнера, и освобождаются разом
+      std::array<std::byte, 2048> buffer;
+      std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size(),
+                                                getMemoryResource());
+      auto invokersTree = makeInvokersTree(i_object, &arena);
+      OperationTimer timer(&stats->updateDependencies);
+      updateDependencies(invokersTree);
+      timer.record(countNodes(invokersTree));
+    }
+
+    // возвращает true, если списки менялись
+    bool updateSimpleInvokers();
+    void updateSimpleInvoker(SimpleInvoker& simpleInvoker,
+                             const ArrayView2<TypeId> i_eventType);
+
+    // i_eventName - имя типа для гистограмм задержек, может быть пустым
+    bool invoke(const void* i_event, const ArrayView2<TypeId> i_eventType,
+                ResultSink* i_sink = nullptr,
+                const std::string_view i_eventName = {});
+    size_t disconnect(const void* i_object);
+    size_t disconnect(const void* i_object,
+                      const ArrayView2<EventMethodType> i_eventMethodTypes);
+
+    inline bool isInvoking() const
+    {
+      return isInInvokeProcess;
+    }
+
+    inline bool hasHandlers(const void* i_object) const
+    {
+      return objectHandlers.count(i_object) > 0;
+    }
+
+    // у объекта есть обработчики базового или производного от i_eventType
+    // типа
+    bool hasRelatedHandlers(const void* i_object,
+                            const ArrayView2<TypeId> i_eventType) const;
+
+    // только меняет бит маски, списки доставки не перестраиваются
+    inline void setGroupEnabled(const Group i_group, const bool i_enabled)
+    {
+      const auto mask = groupMask(i_group);
+      mutedGroups = i_enabled ? mutedGroups & ~mask : mutedGroups | mask;
+    }
+
+    inline GroupMask getMutedGroups() const
+    {
+      return mutedGroups;
+    }
+
+    // есть ли обработчики события этого типа или его базовых типов
+    // (включая обработчики с ключом и с фильтрами); счетчик типа
+    // вычисляется при первом запросе и дальше поддерживается connect/disconnect
+    inline bool hasSubscribers(const ArrayView2<TypeId> i_eventType)
+    {
+      if (const auto it = subscribers.find(i_eventType.back());
+              it != end(subscribers))
+      {
+        return it->second > 0;
+      }
+      return countSubscribers(i_eventType) > 0;
+    }
+
+    inline void setLatencyHistogramsEnabled(const bool i_enabled,
+                                            const uint32_t i_sampling)
+    {
+      latencyEnabled = i_enabled;
+      latencySampling = i_sampling == 0 ? 1 : i_sampling;
+      latencyCountdown = latencySampling;
+    }
+
+    inline const LatencyReport& getLatencyReport() const
+    {
+      return latencyReport;
+    }
+
+    inline const StructureStats& getStructureStats() const
+    {
+      return *stats;
+    }
+
+    inline void resetStructureStats()
+    {
+      *stats = StructureStats();
+    }
+
+    // для обработчиков, хранящихся вне InvokerContainerImpl
+    void changeSubscribers(const TypeId i_eventTypeId, const ptrdiff_t i_delta);
+
+    inline void addOrdering(const HandlerOrdering& i_ordering)
+    {
+      checkOrdering(orderings, i_ordering);
+      orderings.push_back(i_ordering);
+      simpleInvokersUpdated = false;
+    }
+
+    inline const std::pmr::vector<HandlerOrdering>& getOrderings() const
+    {
+      return orderings;
+    }
+
+    // ограничения с отключенным обработчиком удаляются: иначе объект,
+    // подключенный по тому же адресу, унаследовал бы их
+    void removeOrderings(const void* i_object);
+    void removeOrderings(const void* i_object, const MethodId i_methodId);
+
+    inline void setUnorderedDispatch(const TypeId i_eventTypeId,
+                                     const bool i_unordered)
+    {
+      const auto it = std::find(begin(unorderedEventTypes),
+                                end(unorderedEventTypes), i_eventTypeId);
+      if (i_unordered && it == end(unorderedEventTypes))
+      {
+        unorderedEventTypes.push_back(i_eventTypeId);
+      }
+      else if (!i_unordered && it != end(unorderedEventTypes))
+      {
+        unorderedEventTypes.erase(it);
+      }
+      staleEventTypes.push_back(i_eventTypeId);
+    }
+
+  private:
+    inline Invoker* findInvoker(const TypeId eventTypeId)
+    {
+      const auto it = invokers.find(eventTypeId);
+      return it == end(invokers) ? nullptr : &it->second;
+    }
+
+    inline SimpleInvoker* findSimpleInvoker(const TypeId eventTypeId)
+    {
+      const auto it = simpleInvokers.find(eventTypeId);
+      return it == end(simpleInvokers) ? nullptr : &it->second;
+    }
+
+    inline void objectDisconnected(const void* i_object,
+                                   const size_t i_disconnected)
+    {
+      const auto it = objectHandlers.find(i_object);
+      if (it != end(objectHandlers) && (it->second -= i_disconnected) == 0)
+      {
+        objectHandlers.erase(it);
+      }
+    }
+
+    // создает список доставки и вносит его в derivedEventTypes
+    SimpleInvoker& createSimpleInvoker(const ArrayView2<TypeId> i_eventType);
+    // типы со списками доставки, для которых i_eventType - базовый или он сам
+    inline ArrayView2<TypeId> getDerivedEventTypes(const TypeId i_eventTypeId)
+    {
+      const auto it = derivedEventTypes.find(i_eventTypeId);
+      return it == end(derivedEventTypes) ? ArrayView2<TypeId>() : it->second;
+    }
+    // новый обработчик можно дописать в конец готового списка
+    bool canAppend(const TypeId i_eventTypeId, const Handler& i_handler);
+
+    template<typename F>
+    inline void removeOrderingsIf(F isDisconnected)
+    {
+      const auto it = std::remove_if(begin(orderings), end(orderings),
+                                     [&isDisconnected](const auto& ordering)
+                                     {
+                                       return isDisconnected(ordering.before) ||
+                                              isDisconnected(ordering.after);
+                                     });
+      if (it != end(orderings))
+      {
+        orderings.erase(it, end(orderings));
+        // списки остаются допустимыми, но без ограничения порядок
+        // по приоритету может измениться
+        simpleInvokersUpdated = false;
+      }
+    }
+
+    void removeEmpty();
+    size_t countSubscribers(const ArrayView2<TypeId> i_eventType);
+    // списки типа eventType и производных от него будут перестроены
+    void markStale(const ArrayView2<TypeId> eventType);
+    bool applyPendingChanges();
+    size_t disconnect1(const void* i_object, const EventMethodType hash);
+
+    std::pmr::unordered_map<TypeId, Invoker> invokers;
+    std::pmr::unordered_map<TypeId, std::pmr::vector<TypeId>> eventTypes;
+    std::pmr::unordered_map<TypeId, SimpleInvoker> simpleInvokers;
+    bool isInInvokeProcess = false;
+    bool dirty = false;
+    bool simpleInvokersUpdated = false;
+    GroupMask mutedGroups = 0;
+    std::pmr::vector<HandlerOrdering> orderings;
+    std::pmr::vector<TypeId> unorderedEventTypes;
+    // подключенный обработчик, еще не попавший в списки доставки
+    struct PendingHandler
+    {
+      TypeId eventTypeId;
+      // индекс в Invoker::handlers на момент подключения
+      size_t index;
+      size_t pos;
+    };
+    std::pmr::vector<PendingHandler> pendingHandlers;
+    // тип события -> типы со списками доставки, производные от него
+    // (и он сам)
+    std::pmr::unordered_map<TypeId, std::pmr::vector<TypeId>> derivedEventTypes;
+    // число обработчиков каждого объекта
+    std::pmr::unordered_map<const void*, size_t> objectHandlers;
+    // списки, которые надо перестроить на границе доставки
+    std::pmr::vector<TypeId> staleEventTypes;
+    // рабочий массив updateSimpleInvoker
+    std::pmr::vector<const Handler*> orderedHandlers;
+    // число обработчиков собственно типа и с учетом базовых типов
+    std::pmr::unordered_map<TypeId, size_t> ownSubscribers;
+    std::pmr::unordered_map<TypeId, size_t> subscribers;
+    LatencyReport latencyReport;
+    bool latencyEnabled = false;
+    uint32_t latencySampling = 1;
+    // доставок до следующего замера
+    uint32_t latencyCountdown = 1;
+    // в куче: на нее ссылаются Invoker и SimpleInvoker
+    std::unique_ptr<StructureStats> stats = std::make_unique<StructureStats>();
+    size_t pos = 0;
+  };
+
+  // primary template handles events without routing key:
+  template<class, class = void>
+  struct RoutingKeyTraits
+  {
+  };
+
+  // событие объявляет ключ маршрутизации указателем на поле:
+  // static constexpr auto routingKey = &Tick::symbol;
+  template<class T>
+  struct RoutingKeyTraits<T, std::void_t<decltype(T::routingKey)>>
+  {
+    using Key = std::remove_cv_t<std::remove_reference_t<
+            decltype(std::declval<const T&>().*T::routingKey)>>;
+  };
+
+  template<typename T>
+  using RoutingKey = typename RoutingKeyTraits<T>::Key;
+
+  template<class, class = void>
+  struct HasRoutingKey : std::false_type
+  {
+  };
+
+  template<class T>
+  struct HasRoutingKey<T, std::void_t<RoutingKey<T>>> : std::true_type
+  {
+  };
+
+  // категория события: static constexpr Category category = Category::Trace;
+  // события без category относятся к Default
+  enum class Category : uint32_t
+  {
+    Default,
+    Debug,
+    Trace
+  };
+
+  constexpr uint32_t categoryBit(const Category i_category)
+  {
+    return uint32_t(1) << static_cast<uint32_t>(i_category);
+  }
+
+// маска выключенных при сборке категорий, например
+// -DHB4_DISABLED_EVENT_CATEGORIES=6 (Debug и Trace);
+// invoke и connect для таких событий ничего не делают и не компилируются
+#ifndef HB4_DISABLED_EVENT_CATEGORIES
+#define HB4_DISABLED_EVENT_CATEGORIES 0
+#endif
+
+  template<class, class = void>
+  struct EventCategory : std::integral_constant<Category, Category::Default>
+  {
+  };
+
+  template<class T>
+  struct EventCategory<T, std::void_t<decltype(T::category)>> :
+          std::integral_constant<Category, T::category>
+  {
+  };
+
+  template<typename Event>
+  constexpr bool isCategoryEnabled()
+  {
+    return (categoryBit(EventCategory<Event>::value) &
+            uint32_t(HB4_DISABLED_EVENT_CATEGORIES)) == 0;
+  }
+
+  struct IKeyedInvoker
+  {
+    virtual ~IKeyedInvoker() = default;
+    virtual size_t disconnect(const void* object) = 0;
+    virtual size_t disconnect(const void* object, const MethodId methodId) = 0;
+    virtual bool isEmpty() const = 0;
+    // списки доставки будут перестроены при следующем invoke
+    virtual void invalidate() = 0;
+  };
+
+  // обработчики одного типа события, подписанные на конкретный ключ;
+  // скрывать их нечем: объект с такими обработчиками не подписан на
+  // родственные типы (BasicInvokerContainer::checkRoutedConnect)
+  template<typename Key>
+  struct KeyedInvoker : IKeyedInvoker
+  {
+    inline void append(const Key& i_key, Handler handler)
+    {
+      auto& keyHandlers = handlers[i_key];
+      handler.pos = pos++;
+      keyHandlers.invoker.append(handler);
+      keyHandlers.simpleInvokerUpdated = false;
+    }
+
+    inline bool invoke(const Key& i_key, const void* i_event, ResultSink* i_sink,
+                       const InvokerContainerImpl& i_impl)
+    {
+      const auto it = handlers.find(i_key);
+      if (it == end(handlers))
+      {
+        return false;
+      }
+      auto& keyHandlers = it->second;
+      if (!keyHandlers.simpleInvokerUpdated &&
+          !keyHandlers.simpleInvoker.isInvoking())
+      {
+        keyHandlers.simpleInvoker.clear();
+        std::pmr::vector<const Handler*> ordered(i_impl.getMemoryResource());
+        for (const auto& handler: keyHandlers.invoker.handlers)
+        {
+          if (handler.has_value())
+          {
+            ordered.push_back(&*handler);
+          }
+        }
+        orderHandlers(ordered, i_impl.getOrderings());
+        for (const auto* handler: ordered)
+        {
+          keyHandlers.simpleInvoker.append(*handler);
+        }
+        keyHandlers.simpleInvokerUpdated = true;
+      }
+      return keyHandlers.simpleInvoker.invoke(i_event, i_sink,
+                                              i_impl.getMutedGroups());
+    }
+
+    size_t disconnect(const void* object) override
+    {
+      return removeIf([object](KeyHandlers& keyHandlers)
+                      {
+                        keyHandlers.simpleInvoker.disconnect(object);
+                        return keyHandlers.invoker.disconnect(object);
+                      });
+    }
+
+    size_t disconnect(const void* object, const MethodId methodId) override
+    {
+      return removeIf([object, methodId](KeyHandlers& keyHandlers)
+                      {
+                        keyHandlers.simpleInvoker.disconnect(object, methodId);
+                        return keyHandlers.invoker.disconnect(object, methodId);
+                      });
+    }
+
+    bool isEmpty() const override
+    {
+      return handlers.empty();
+    }
+
+    void invalidate() override
+    {
+      for (auto&[_, keyHandlers]: handlers)
+      {
+        keyHandlers.simpleInvokerUpdated = false;
+      }
+    }
+
+  private:
+    struct KeyHandlers
+    {
+      Invoker invoker;
+      SimpleInvoker simpleInvoker;
+      bool simpleInvokerUpdated = false;
+    };
+
+    template<typename F>
+    inline size_t removeIf(F disconnect)
+    {
+      size_t disconnected = 0;
+      for (auto it = begin(handlers); it != end(handlers);)
+      {
+        auto& keyHandlers = it->second;
+        // отключенные обработчики уже заменены в списке доставки,
+        // перестраивать его не нужно
+        disconnected += disconnect(keyHandlers);
+        // список, по которому сейчас идет доставка, удалять нельзя
+        if (keyHandlers.invoker.isEmpty() &&
+            !keyHandlers.simpleInvoker.isInvoking())
+        {
+          it = handlers.erase(it);
+        }
+        else
+        {
+          ++it;
+        }
+      }
+      return disconnected;
+    }
+
+    std::unordered_map<Key, KeyHandlers> handlers;
+    size_t pos = 0;
+  };
+
+  template<typename T>
+  struct MemberTraits;
+
+  template<typename C, typename T>
+  struct MemberTraits<T C::*>
+  {
+    using Class = C;
+    using Type = T;
+  };
+
+  template<auto Field>
+  using FieldType = typename MemberTraits<decltype(Field)>::Type;
+
+  // event.*Field <op> value; AnyBits: (field & value) != 0,
+  // AllBits: (field & value) == value, только для целых полей
+  enum class FilterOp
+  {
+    Equal,
+    NotEqual,
+    Less,
+    LessEqual,
+    Greater,
+    GreaterEqual,
+    AnyBits,
+    AllBits,
+    Count
+  };
+
+  // connect<&H::onTick>(h, Filter<&Tick::price>{FilterOp::Greater, 100.0});
+  template<auto Field>
+  struct Filter
+  {
+    FilterOp op;
+    FieldType<Field> value;
+  };
+
+  template<FilterOp Op, typename T>
+  constexpr bool compare(const T i_field, const T i_value)
+  {
+    if constexpr (Op == FilterOp::Equal)
+    {
+      return i_field == i_value;
+    }
+    else if constexpr (Op == FilterOp::NotEqual)
+    {
+      return i_field != i_value;
+    }
+    else if constexpr (Op == FilterOp::Less)
+    {
+      return i_field < i_value;
+    }
+    else if constexpr (Op == FilterOp::LessEqual)
+    {
+      return i_field <= i_value;
+    }
+    else if constexpr (Op == FilterOp::Greater)
+    {
+      return i_field > i_value;
+    }
+    else if constexpr (Op == FilterOp::GreaterEqual)
+    {
+      return i_field >= i_value;
+    }
+    else if constexpr (Op == FilterOp::AnyBits)
+    {
+      return (i_field & i_value) != 0;
+    }
+    else
+    {
+      return (i_field & i_value) == i_value;
+    }
+  }
+
+  // без ветвлений внутри цикла, компилятор векторизует
+  template<FilterOp Op, typename T>
+  inline void evaluateFilter(const T i_field, const T* i_values,
+                             uint8_t* o_matches, const size_t i_size)
+  {
+    for (size_t i = 0; i < i_size; ++i)
+    {
+      o_matches[i] = compare<Op>(i_field, i_values[i]);
+    }
+  }
+
+  struct IFilterColumn;
+
+  // обработчик, прошедший фильтр: pos - порядок подключения
+  struct FilterMatch
+  {
+    size_t pos;
+    IFilterColumn* column;
+    FilterOp op;
+    size_t index;
+  };
+
+  struct IFilterColumn
+  {
+    virtual ~IFilterColumn() = default;
+    // дописывает в o_matches подключенные обработчики, прошедшие фильтр
+    virtual void match(const void* event, const GroupMask mutedGroups,
+                       std::vector<FilterMatch>& o_matches) = 0;
+    // вызывает обработчик, если он еще подключен;
+    // возвращает true, если событие поглощено
+    virtual bool invoke(const FilterOp op, const size_t index, const void* event,
+                        ResultSink* sink) = 0;
+    virtual size_t disconnect(const void* object) = 0;
+    virtual size_t disconnect(const void* object, const MethodId methodId) = 0;
+    // удаляет отключенные обработчики; не во время доставки
+    virtual void removeEmpty() = 0;
+  };
+
+  // все фильтры по одному полю события: для каждой операции константы лежат
+  // в отдельном массиве и сравниваются с полем события за один проход
+  template<typename Event, auto Field>
+  struct FilterColumn : IFilterColumn
+  {
+    using T = FieldType<Field>;
+    static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T>,
+                  "filters need an arithmetic field");
+
+    inline void append(const Filter<Field>& i_filter, const Handler& i_handler)
+    {
+#ifdef HB4_PROFILE_HANDLERS
+      // фильтрованные обработчики не профилируются
+      releaseProfileRecord(i_handler.profile);
+#endif
+      if constexpr (!std::is_integral_v<T>)
+      {
+        if (i_filter.op == FilterOp::AnyBits || i_filter.op == FilterOp::AllBits)
         {
-          return updateTreeFrom(treeNode.subTree, newTypeInfo, handler);
+          throw std::invalid_argument("HB4: bit filters need an integral field");
         }
-        if (isBaseOf(newTypeInfo, treeNode.value.eventTypeInfo))
+      }
+      auto& column = columns[static_cast<size_t>(i_filter.op)];
+      column.values.push_back(i_filter.value);
+      column.entries.push_back(Entry{i_handler.fv, i_handler.methodId,
+                                     i_handler.groups, i_handler.pos,
+                                     i_handler.consumes, true});
+    }
+
+    void match(const void* i_event, const GroupMask i_mutedGroups,
+               std::vector<FilterMatch>& o_matches) override
+    {
+      const T field = static_cast<const Event*>(i_event)->*Field;
+      matchColumn<FilterOp::Equal>(field, i_mutedGroups, o_matches);
+      matchColumn<FilterOp::NotEqual>(field, i_mutedGroups, o_matches);
+      matchColumn<FilterOp::Less>(field, i_mutedGroups, o_matches);
+      matchColumn<FilterOp::LessEqual>(field, i_mutedGroups, o_matches);
+      matchColumn<FilterOp::Greater>(field, i_mutedGroups, o_matches);
+      matchColumn<FilterOp::GreaterEqual>(field, i_mutedGroups, o_matches);
+      matchColumn<FilterOp::AnyBits>(field, i_mutedGroups, o_matches);
+      matchColumn<FilterOp::AllBits>(field, i_mutedGroups, o_matches);
+    }
+
+    bool invoke(const FilterOp i_op, const size_t i_index, const void* i_event,
+                ResultSink* i_sink) override
+    {
+      // массив мог вырасти, но индексы до removeEmpty не сдвигаются
+      const auto& entry = columns[static_cast<size_t>(i_op)].entries[i_index];
+      return entry.connected && entry.fv.invoke(i_event, i_sink) &&
+             entry.consumes;
+    }
+
+    size_t disconnect(const void* i_object) override
+    {
+      return disableIf([i_object](const auto& entry)
+                       {
+                         return entry.fv.getObject() == i_object;
+                       });
+    }
+
+    size_t disconnect(const void* i_object, const MethodId i_methodId) override
+    {
+      return disableIf([i_object, i_methodId](const auto& entry)
+                       {
+                         return entry.fv.getObject() == i_object &&
+                                entry.methodId == i_methodId;
+                       });
+    }
+
+    void removeEmpty() override
+    {
+      if (!dirty)
+      {
+        return;
+      }
+      for (auto& column: columns)
+      {
+        size_t kept = 0;
+        for (size_t i = 0; i < column.entries.size(); ++i)
         {
-          auto extractedTreeNode = std::move(treeNode);
-          treeNode.value.eventTypeInfo = newTypeInfo;
-          treeNode.value.handlers = decltype(treeNode.value.handlers){&handler};
-          treeNode.subTree =
-                  decltype(treeNode.subTree){std::move(extractedTreeNode)};
-          return &treeNode;
+          if (column.entries[i].connected)
+          {
+            column.values[kept] = column.values[i];
+            column.entries[kept] = column.entries[i];
+            ++kept;
+          }
         }
-        if (newTypeInfo.back() == treeNode.value.eventTypeInfo.back())
+        column.values.resize(kept);
+        column.entries.erase(begin(column.entries) + kept, end(column.entries));
+      }
+      dirty = false;
+    }
+
+  private:
+    struct Entry
+    {
+      ObjectFunctionView fv;
+      MethodId methodId;
+      GroupMask groups;
+      size_t pos;
+      bool consumes;
+      bool connected;
+    };
+
+    struct Column
+    {
+      std::vector<T> values;
+      std::vector<Entry> entries;
+    };
+
+    // совпадения собираются до вызова обработчиков, поэтому вложенная
+    // доставка не портит рабочий массив matches
+    template<FilterOp Op>
+    inline void matchColumn(const T i_field, const GroupMask i_mutedGroups,
+                            std::vector<FilterMatch>& o_matches)
+    {
+      if constexpr ((Op == FilterOp::AnyBits || Op == FilterOp::AllBits) &&
+                    !std::is_integral_v<T>)
+      {
+        return;
+      }
+      else
+      {
+        const auto& column = columns[static_cast<size_t>(Op)];
+        const auto size = column.values.size();
+        if (size == 0)
         {
-          treeNode.value.handlers.push_back(&handler);
-          return &treeNode;
+          return;
+        }
+        matches.resize(size);
+        evaluateFilter<Op>(i_field, column.values.data(), matches.data(), size);
+        for (size_t i = 0; i < size; ++i)
+        {
+          const auto& entry = column.entries[i];
+          if (matches[i] && entry.connected &&
+              (entry.groups & i_mutedGroups) == 0)
+          {
+            o_matches.push_back(FilterMatch{entry.pos, this, Op, i});
+          }
+        }
+      }
+    }
+
+    template<typename F>
+    inline size_t disableIf(F shouldRemove)
+    {
+      size_t disconnected = 0;
+      for (auto& column: columns)
+      {
+        for (auto& entry: column.entries)
+        {
+          if (entry.connected && shouldRemove(entry))
+          {
+            entry.connected = false;
+            ++disconnected;
+          }
+        }
+      }
+      dirty = dirty || disconnected > 0;
+      return disconnected;
+    }
+
+    std::array<Column, static_cast<size_t>(FilterOp::Count)> columns;
+    std::vector<uint8_t> matches;
+    bool dirty = false;
+  };
+
+  // фильтрованные обработчики одного типа события, по колонке на поле;
+  // прошедшие фильтры вызываются в порядке подключения
+  struct FilteredInvoker
+  {
+    template<typename Event, auto Field>
+    inline void append(const Hash i_fieldId, const Filter<Field>& i_filter,
+                       Handler i_handler)
+    {
+      i_handler.pos = pos;
+      getOrCreateColumn<Event, Field>(i_fieldId).append(i_filter, i_handler);
+      ++pos;
+    }
+
+    inline bool invoke(const void* i_event, ResultSink* i_sink,
+                       const GroupMask i_mutedGroups)
+    {
+      // рабочий массив своей глубины вложенности: узлы deque не
+      // перемещаются, когда вложенная доставка добавляет уровень
+      if (scratch.size() <= depth)
+      {
+        scratch.emplace_back();
+      }
+      auto& matches = scratch[depth];
+      matches.clear();
+      for (auto&[_, column]: columns)
+      {
+        column->match(i_event, i_mutedGroups, matches);
+      }
+      std::sort(begin(matches), end(matches),
+                [](const FilterMatch& left, const FilterMatch& right)
+                {
+                  return left.pos < right.pos;
+                });
+      ++depth;
+      bool consumed = false;
+      {
+        const ScopeExit invokeExit([this]()
+                                   {
+                                     --depth;
+                                   });
+        for (size_t i = 0; i < matches.size() && !consumed; ++i)
+        {
+          const auto& match = matches[i];
+          consumed = match.column->invoke(match.op, match.index, i_event, i_sink);
+        }
+      }
+      if (depth == 0)
+      {
+        removeEmpty();
+      }
+      return consumed;
+    }
+
+    template<typename... MethodIds>
+    inline size_t disconnect(const void* i_object, const MethodIds... i_methodId)
+    {
+      size_t disconnected = 0;
+      for (auto&[_, column]: columns)
+      {
+        disconnected += column->disconnect(i_object, i_methodId...);
+      }
+      if (depth == 0)
+      {
+        removeEmpty();
+      }
+      return disconnected;
+    }
+
+  private:
+    template<typename Event, auto Field>
+    inline FilterColumn<Event, Field>& getOrCreateColumn(const Hash i_fieldId)
+    {
+      for (auto&[fieldId, column]: columns)
+      {
+        if (fieldId == i_fieldId)
+        {
+          return static_cast<FilterColumn<Event, Field>&>(*column);
+        }
+      }
+      columns.emplace_back(i_fieldId,
+                           std::make_unique<FilterColumn<Event, Field>>());
+      return static_cast<FilterColumn<Event, Field>&>(*columns.back().second);
+    }
+
+    inline void removeEmpty()
+    {
+      for (auto&[_, column]: columns)
+      {
+        column->removeEmpty();
+      }
+    }
+
+    std::vector<std::pair<Hash, std::unique_ptr<IFilterColumn>>> columns;
+    std::deque<std::vector<FilterMatch>> scratch;
+    size_t depth = 0;
+    size_t pos = 0;
+  };
+
+  // коллекторы для InvokerContainer::invoke(event, collector)
+  template<typename T>
+  struct Sum
+  {
+    using Value = T;
+
+    inline void add(const T& i_value)
+    {
+      value += i_value;
+    }
+
+    T value{};
+  };
+
+  template<typename T>
+  struct Max
+  {
+    using Value = T;
+
+    inline void add(const T& i_value)
+    {
+      if (!value.has_value() || *value < i_value)
+      {
+        value = i_value;
+      }
+    }
+
+    std::optional<T> value;
+  };
+
+  // обработчики возвращают std::optional<T>; запоминается первый
+  // непустой результат, следующие отбрасываются
+  template<typename T>
+  struct FirstNonEmpty
+  {
+    using Value = std::optional<T>;
+
+    inline void add(const Value& i_value)
+    {
+      if (!value.has_value())
+      {
+        value = i_value;
+      }
+    }
+
+    Value value;
+  };
+
+  // складывает результаты в буфер вызывающего; без выделения памяти,
+  // пока хватает емкости, лишние результаты отбрасываются
+  template<typename T>
+  struct IntoBuffer
+  {
+    using Value = T;
+
+    inline void add(const T& i_value)
+    {
+      if (size < capacity)
+      {
+        data[size++] = i_value;
+      }
+    }
+
+    T* data;
+    size_t capacity;
+    size_t size = 0;
+  };
+
+  // отключает обработчик-функтор при разрушении;
+  // не должен переживать контейнер, которым выдан
+  struct ScopedConnection
+  {
+    using DisconnectFunction = void (*)(void* container, void* object);
+
+    ScopedConnection() = default;
+
+    ScopedConnection(void* i_container, void* i_object,
+                     const DisconnectFunction i_disconnectFunction):
+            container(i_container), object(i_object),
+            disconnectFunction(i_disconnectFunction)
+    {
+    }
+
+    ScopedConnection(ScopedConnection&& other) noexcept:
+            container(other.container), object(other.object),
+            disconnectFunction(std::exchange(other.disconnectFunction, nullptr))
+    {
+    }
+
+    ScopedConnection& operator=(ScopedConnection&& other) noexcept
+    {
+      if (this != &other)
+      {
+        disconnect();
+        container = other.container;
+        object = other.object;
+        disconnectFunction = std::exchange(other.disconnectFunction, nullptr);
+      }
+      return *this;
+    }
+
+    ~ScopedConnection()
+    {
+      disconnect();
+    }
+
+    inline void disconnect()
+    {
+      if (disconnectFunction)
+      {
+        std::exchange(disconnectFunction, nullptr)(container, object);
+      }
+    }
+
+    // обработчик остается подключенным до разрушения контейнера
+    inline void release()
+    {
+      disconnectFunction = nullptr;
+    }
+
+    inline bool isConnected() const
+    {
+      return disconnectFunction != nullptr;
+    }
+
+  private:
+    void* container = nullptr;
+    void* object = nullptr;
+    DisconnectFunction disconnectFunction = nullptr;
+  };
+
+  // подключение набора объектов (connectRange); границы набора меняются
+  // без перестроения списков доставки и без затрагивания других подписок
+  template<typename T>
+  struct RangeConnection
+  {
+    RangeConnection(ScopedConnection i_connection, ObjectRange<T>* i_range):
+            connection(std::move(i_connection)), range(i_range)
+    {
+    }
+
+    // новый набор виден со следующего вызова обработчиков набора;
+    // старый набор должен оставаться живым до конца текущей доставки
+    inline void resize(T* i_base, const size_t i_count)
+    {
+      if (connection.isConnected())
+      {
+        range->base = i_base;
+        range->count = i_count;
+      }
+    }
+
+    inline size_t size() const
+    {
+      return connection.isConnected() ? range->count : 0;
+    }
+
+    inline void disconnect()
+    {
+      connection.disconnect();
+    }
+
+    inline bool isConnected() const
+    {
+      return connection.isConnected();
+    }
+
+  private:
+    ScopedConnection connection;
+    ObjectRange<T>* range;
+  };
+
+  // место под лямбду или функтор; адрес слота - object обработчика
+  template<size_t Capacity>
+  struct FunctorSlot
+  {
+    alignas(std::max_align_t) unsigned char storage[Capacity];
+    void (*destroy)(void*) = nullptr;
+  };
+
+  // что делать с invoke, вызванным из обработчика того же контейнера
+  enum class DispatchMode
+  {
+    // вложенное событие доставляется сразу, рекурсивно
+    DepthFirst,
+    // вложенное событие копируется в очередь и доставляется после текущего,
+    // в порядке поступления; глубина стека не растет, а удаленные
+    // обработчики вычищаются между событиями
+    Deferred
+  };
+
+  struct InvokerContainerTraits
+  {
+    using TypeIds = AddressTypeIds;
+    // максимальный размер лямбды (захватов) или функтора
+    static constexpr size_t functorCapacity = 4 * sizeof(void*);
+  };
+
+  // для обработчиков из плагинов, загружаемых через dlopen
+  struct StableInvokerContainerTraits : InvokerContainerTraits
+  {
+    using TypeIds = StableTypeIds;
+  };
+
+  template<typename Traits = InvokerContainerTraits>
+  struct BasicInvokerContainer
+  {
+    using TypeIds = typename Traits::TypeIds;
+    using Slot = FunctorSlot<Traits::functorCapacity>;
+
+    BasicInvokerContainer() = default;
+
+    // таблицы обработчиков, списки доставки и массивы скрытых типов
+    // размещаются в i_resource (например, std::pmr::unsynchronized_pool_resource);
+    // ресурс должен жить дольше контейнера. Обработчики с ключом и
+    // с фильтрами и отложенные события используют общую кучу
+    explicit BasicInvokerContainer(std::pmr::memory_resource* i_resource)
+            : invokerContainerImpl(i_resource)
+    {
+    }
+
+    BasicInvokerContainer(const BasicInvokerContainer&) = delete;
+    BasicInvokerContainer& operator=(const BasicInvokerContainer&) = delete;
+
+    ~BasicInvokerContainer()
+    {
+      for (auto& slot: functorSlots)
+      {
+        if (slot.destroy)
+        {
+          slot.destroy(slot.storage);
         }
       }
-      result.push_back({{newTypeInfo, {&handler}}});
-      return &result.back();
     }
 
-    inline void updateTreeFrom(std::vector<EventHandlersTreeNode>& result,
-                               Invoker& invoker, const TypeId eventTypeId,
-                               const void* i_object)
+    // обработчики с ключом и с фильтрами вызываются после общих,
+    // от самого производного типа события к корню
+    template<typename Event>
+    void invoke(const Event& event)
     {
-      EventHandlersTreeNode* eventHandlersTreeNode = nullptr;
-      for (auto& handler: invoker.handlers)
+      if constexpr (isCategoryEnabled<Event>())
       {
-        if (handler.has_value() && handler->getObject() == i_object)
+        if constexpr (std::is_copy_constructible_v<Event>)
         {
-          if (eventHandlersTreeNode)
+          if (dispatchMode == DispatchMode::Deferred && isDispatching)
           {
-            eventHandlersTreeNode->value.handlers.push_back(&*handler);
+            deferredEvents.push_back(
+                    std::make_unique<DeferredEvent<Event>>(event));
+            return;
           }
-          else
+        }
+        invoke<Event>(event, typeInfo<Event, TypeIds>(), nullptr);
+      }
+    }
+
+    // передает результаты обработчиков в collector.add(value): типа
+    // Collector::Value как есть, арифметические - приведенными к Value.
+    // Возвращает число результатов, которые нельзя передать коллектору
+    // (тип не Value и не приводится); такие обработчики вызываются как обычно
+    template<typename Event, typename Collector>
+    size_t invoke(const Event& event, Collector& collector)
+    {
+      using Value = typename Collector::Value;
+      static_assert(std::is_same_v<Value, std::decay_t<Value>>,
+                    "Collector::Value must not be a reference or cv-qualified");
+      if constexpr (isCategoryEnabled<Event>())
+      {
+        ResultSink sink{TypeIds::template typeId<Value>(), &collector,
+                        [](void* collector, const void* value)
+                        {
+                          static_cast<Collector*>(collector)->add(
+                                  *static_cast<const Value*>(value));
+                        },
+                        nullptr};
+        if constexpr (std::is_arithmetic_v<Value>)
+        {
+          sink.acceptNumeric = [](void* collector, const NumericResult& value)
           {
-            const auto eventTypeInfo = getTypeInfo(eventTypeId);
-            eventHandlersTreeNode =
-                    updateTreeFrom(result, eventTypeInfo, *handler);
-          }
+            auto& typed = *static_cast<Collector*>(collector);
+            switch (value.kind)
+            {
+              case NumericResult::Kind::Signed:
+                typed.add(static_cast<Value>(value.asSigned));
+                break;
+              case NumericResult::Kind::Unsigned:
+                typed.add(static_cast<Value>(value.asUnsigned));
+                break;
+              case NumericResult::Kind::Floating:
+                typed.add(static_cast<Value>(value.asFloating));
+                break;
+            }
+          };
         }
+        invoke<Event>(event, typeInfo<Event, TypeIds>(), &sink);
+        return sink.mismatched;
+      }
+      else
+      {
+        return 0;
       }
     }
 
-    inline std::vector<EventHandlersTreeNode> makeInvokersTree(
-            const void* i_object)
+    // доставка по реальному (самому производному) типу события,
+    // доступному через ссылку на корень иерархии;
+    // обработчики с ключом и с фильтрами выбираются по статическому типу Root
+    template<typename Root>
+    void invokeDynamic(const Root& event)
     {
-      std::vector<EventHandlersTreeNode> result;
-      for (auto&[eventTypeId, invoker]: invokers)
+      static_assert(std::is_base_of_v<DynamicTypeInfo, Root>,
+                    "Root must be derived from HB4::Dispatchable");
+      static_assert(std::is_same_v<typename Root::DispatchTypeIds, TypeIds>,
+                    "Root and container must use the same TypeIds policy");
+      if constexpr (isCategoryEnabled<Root>())
       {
-        updateTreeFrom(result, invoker, eventTypeId, i_object);
+        invoke<Root>(event, event.getDynamicTypeInfo(), nullptr);
       }
-      return result;
     }
 
-    inline static std::vector<ArrayView2<TypeId>> getDirectСhildren(
-            const std::vector<EventHandlersTreeNode>& i_tree,
-            const ArrayView2<TypeId> eventTypeInfo)
+    template<auto ...Methods>
+    void connect(Class<Methods...>& i_object, Register<Methods...>)
     {
-      std::vector<ArrayView2<TypeId>> result;
-      for (const auto& node: i_tree)
+      connect<Methods...>(i_object);
+    }
+
+    // i_options - группа для setGroupEnabled и приоритет
+    template<auto... Methods>
+    void connect(Class<Methods...>& i_object,
+                 const ConnectOptions& i_options = {})
+    {
+      (connectHandler<Methods>(i_object, i_options), ...);
+    }
+
+    // обработчик вызывается только для событий с event.*routingKey == i_key.
+    // Обработчики с ключом и с фильтрами вызываются после обычных, и скрытие
+    // обработчиков базовых типов к ним не применяется, поэтому у объекта
+    // с такими обработчиками не может быть обычных обработчиков и
+    // обработчиков с ключом или фильтром для базового или производного типа
+    // события: std::invalid_argument
+    template<auto Method>
+    void connect(Class<Method>& i_object,
+                 const RoutingKey<Argument<Method>>& i_key,
+                 const ConnectOptions& i_options = {})
+    {
+      using Event = Argument<Method>;
+      if constexpr (!isCategoryEnabled<Event>())
       {
-        if (node.value.eventTypeInfo.back() == eventTypeInfo.back())
+        return;
+      }
+      else
+      {
+        checkRoutedConnect(&i_object, typeInfo<Event, TypeIds>());
+        getOrCreateKeyedInvoker<Event>().append(
+                i_key, Handler(i_object, TemplateParameter<Method>(), TypeIds(),
+                               i_options));
+        routedConnected(&i_object, typeInfo<Event, TypeIds>());
+      }
+    }
+
+    // обработчик вызывается только для событий, прошедших фильтр;
+    // прошедшие фильтры обработчики типа вызываются в порядке подключения,
+    // приоритет и addOrdering к ним не применяются; ограничения на объект -
+    // как у обработчиков с ключом
+    template<auto Method, auto Field>
+    void connect(Class<Method>& i_object, const Filter<Field>& i_filter,
+                 const ConnectOptions& i_options = {})
+    {
+      using Event = Argument<Method>;
+      if constexpr (!isCategoryEnabled<Event>())
+      {
+        return;
+      }
+      else
+      {
+        checkRoutedConnect(&i_object, typeInfo<Event, TypeIds>());
+        filteredInvokers[TypeIds::template typeId<Event>()]
+                .template append<Event, Field>(
+                        TypeIds::template methodId<Field>(), i_filter,
+                        Handler(i_object, TemplateParameter<Method>(), TypeIds(),
+                                i_options));
+        routedConnected(&i_object, typeInfo<Event, TypeIds>());
+      }
+    }
+
+    // лямбда, функтор или свободная функция; хранится в слоте контейнера
+    // (без выделения памяти под сам функтор), отключается токеном
+    template<typename F>
+    [[nodiscard]] ScopedConnection connect(
+            F&& i_functor, const ConnectOptions& i_options = {})
+    {
+      using Functor = std::decay_t<F>;
+      static_assert(sizeof(Functor) <= Traits::functorCapacity,
+                    "functor does not fit, increase Traits::functorCapacity");
+      static_assert(alignof(Functor) <= alignof(std::max_align_t));
+      if constexpr (!isCategoryEnabled<CallableArgument<Functor>>())
+      {
+        return {};
+      }
+      else
+      {
+        auto& slot = allocateFunctorSlot();
+        auto* functor = new(slot.storage) Functor(std::forward<F>(i_functor));
+        slot.destroy = [](void* storage)
         {
-          std::transform(begin(node.subTree), end(node.subTree),
-                         std::back_inserter(result), [](const auto& node)
-                         {
-                           return node.value.eventTypeInfo;
-                         });
-          return result;
-        }
-        if (isBaseOf(node.value.eventTypeInfo, eventTypeInfo))
+          static_cast<Functor*>(storage)->~Functor();
+        };
+        invokerContainerImpl.connect(
+                typeInfo<CallableArgument<Functor>, TypeIds>(),
+                Handler(*functor, TemplateType<Functor>(), TypeIds(), i_options));
+        return ScopedConnection(this, &slot, [](void* container, void* object)
         {
-          return getDirectСhildren(node.subTree, eventTypeInfo);
-        }
+          static_cast<BasicInvokerContainer*>(container)->disconnectFunctor(
+                  *static_cast<Slot*>(object));
+        });
       }
-      return result;
     }
 
-    inline void updateDependencies(std::vector<EventHandlersTreeNode>& nodes)
+    // один обработчик на метод для всего набора объектов вместо обработчика
+    // на объект; скрытие обработчиков базовых типов действует между методами
+    // одного набора
+    template<auto... Methods>
+    [[nodiscard]] RangeConnection<Class<Methods...>> connectRange(
+            Class<Methods...>* i_base, const size_t i_count,
+            const size_t i_stride = sizeof(Class<Methods...>),
+            const ConnectOptions& i_options = {})
     {
-      for (auto& node: nodes)
+      using Range = ObjectRange<Class<Methods...>>;
+      static_assert(sizeof(Range) <= Traits::functorCapacity);
+      if constexpr (!(isCategoryEnabled<Argument<Methods>>() || ...))
       {
-        const auto directChildren =
-                getDirectСhildren(nodes, node.value.eventTypeInfo);
-        for (auto* handler: node.value.handlers)
+        return {ScopedConnection(), nullptr};
+      }
+      else
+      {
+        auto& slot = allocateFunctorSlot();
+        auto* range = new(slot.storage) Range{i_base, i_count, i_stride};
+        slot.destroy = [](void* storage)
+        {
+          static_cast<Range*>(storage)->~Range();
+        };
+        (connectHandler<Methods>(*range, i_options), ...);
+        return {ScopedConnection(this, &slot, [](void* container, void* object)
+                {
+                  static_cast<BasicInvokerContainer*>(container)->disconnectFunctor(
+                          *static_cast<Slot*>(object));
+                }), range};
+      }
+    }
+
+    template<typename Object>
+    size_t disconnect(const Object& i_object)
+    {
+      const auto routed = routedObjects.find(&i_object);
+      if (routed == end(routedObjects))
+      {
+        return invokerContainerImpl.disconnect(&i_object);
+      }
+      size_t disconnected = invokerContainerImpl.disconnect(&i_object);
+      for (auto&[eventTypeId, keyedInvoker]: keyedInvokers)
+      {
+        disconnected += routedDisconnected(
+                eventTypeId, keyedInvoker->disconnect(&i_object));
+      }
+      for (auto&[eventTypeId, filteredInvoker]: filteredInvokers)
+      {
+        disconnected += routedDisconnected(
+                eventTypeId, filteredInvoker.disconnect(&i_object));
+      }
+      routedObjects.erase(routed);
+      invokerContainerImpl.removeOrderings(&i_object);
+      return disconnected;
+    }
+
+    template<auto... Methods>
+    size_t disconnect(const Class<Methods...>& i_object)
+    {
+      const std::array<EventMethodType, sizeof...(Methods)> eventMethodTypes{
+              EventMethodType{TypeIds::template typeId<Argument<Methods>>(),
+                              TypeIds::template methodId<Methods>()}...};
+      return invokerContainerImpl.disconnect(&i_object, eventMethodTypes) +
+             (disconnectRouted<Methods>(i_object) + ...);
+    }
+
+    // выключенная группа пропускается при доставке, списки доставки
+    // не перестраиваются; можно вызывать из обработчика
+    void setGroupEnabled(const Group i_group, const bool i_enabled)
+    {
+      invokerContainerImpl.setGroupEnabled(i_group, i_enabled);
+    }
+
+    // O(1) после первого запроса для типа
+    template<typename Event>
+    bool hasSubscribers()
+    {
+      if constexpr (isCategoryEnabled<Event>())
+      {
+        return invokerContainerImpl.hasSubscribers(typeInfo<Event, TypeIds>());
+      }
+      else
+      {
+        return false;
+      }
+    }
+
+    // событие создается из args, только если его кто-то получит:
+    // ic.emit<TraceEvent>(formatMessage(...)) без подписчиков не форматирует
+    // ничего, если formatMessage вызывается в конструкторе события
+    template<typename Event, typename... Args>
+    void emit(Args&&... args)
+    {
+      if constexpr (!isCategoryEnabled<Event>())
+      {
+        return;
+      }
+      else
+      {
+        if (!hasSubscribers<Event>())
         {
-          handler->notProcessesEvents = directChildren;
+          return;
+        }
+        if constexpr (std::is_constructible_v<Event, Args&&...>)
+        {
+          invoke(Event(std::forward<Args>(args)...));
+        }
+        else
+        {
+          invoke(Event{std::forward<Args>(args)...});
         }
-        updateDependencies(node.subTree);
       }
     }
 
-    inline void updateDependencies(const void* i_object)
+    // гистограммы задержек доставки по типам событий; замеряется одна из
+    // i_sampling доставок (два чтения счетчика тактов и запись в гистограмму
+    // без атомарных сложений), доставки с перестроением списков - все.
+    // Гистограммы пишет только поток доставки, сводятся LatencyReport::merge
+    void setLatencyHistogramsEnabled(const bool i_enabled,
+                                     const uint32_t i_sampling = 16)
     {
-      auto invokersTree = makeInvokersTree(i_object);
-      updateDependencies(invokersTree);
+      invokerContainerImpl.setLatencyHistogramsEnabled(i_enabled, i_sampling);
+    }
+
+    const LatencyReport& getLatencyReport() const
+    {
+      return invokerContainerImpl.getLatencyReport();
     }
 
-    void updateSimpleInvokers();
+    // счетчики и время перестроений списков доставки, дерева зависимостей
+    // и уплотнений массивов; время не измеряется при сборке с
+    // STRUCTURE_STATS_NO_TIMING (StructureStats::timed); обработчики
+    // с ключом и с фильтрами не учитываются
+    const StructureStats& getStructureStats() const
+    {
+      return invokerContainerImpl.getStructureStats();
+    }
 
-    void invoke(const void* i_event, const ArrayView2<TypeId> i_eventType);
-    size_t disconnect(const void* i_object);
-    size_t disconnect(const void* i_object,
-                      const ArrayView2<EventMethodType> i_eventMethodTypes);
+    void resetStructureStats()
+    {
+      invokerContainerImpl.resetStructureStats();
+    }
 
-  private:
-    inline Invoker* findInvoker(const TypeId eventTypeId)
+    // Deferred действует на invoke(event); invoke с коллектором и
+    // invokeDynamic всегда доставляют сразу, события без копирования - тоже
+    void setDispatchMode(const DispatchMode i_dispatchMode)
     {
-      const auto it = invokers.find(eventTypeId);
-      return it == end(invokers) ? nullptr : &it->second;
+      dispatchMode = i_dispatchMode;
     }
 
-    inline SimpleInvoker* findSimpleInvoker(const TypeId eventTypeId)
+    // обработчик Before объекта i_before вызывается раньше обработчика After
+    // объекта i_after в каждом списке, где есть оба; порядок вычисляется при
+    // построении списков, цикл из ограничений - std::logic_error
+    template<auto Before, auto After>
+    void addOrdering(const Class<Before>& i_before, const Class<After>& i_after)
     {
-      const auto it = simpleInvokers.find(eventTypeId);
-      return it == end(simpleInvokers) ? nullptr : &it->second;
+      invokerContainerImpl.addOrdering(
+              {{&i_before, TypeIds::template methodId<Before>()},
+               {&i_after, TypeIds::template methodId<After>()}});
+      for (auto&[_, keyedInvoker]: keyedInvokers)
+      {
+        keyedInvoker->invalidate();
+      }
     }
 
-    void removeEmpty();
+    // для событий типа Event порядок обработчиков не гарантируется
+    // (приоритеты и addOrdering не действуют): список доставки группируется
+    // по функции-переходнику, что уменьшает промахи предсказателя переходов
+    // при большом числе обработчиков разных классов
+    template<typename Event>
+    void setUnorderedDispatch(const bool i_unordered = true)
+    {
+      invokerContainerImpl.setUnorderedDispatch(TypeIds::template typeId<Event>(),
+                                                i_unordered);
+    }
 
-    inline size_t disconnect1(const void* i_object, const EventMethodType hash)
+  private:
+    // i_object - объект или ObjectRange
+    template<auto Method, typename Object>
+    inline void connectHandler(Object& i_object, const ConnectOptions& i_options)
     {
-      if (auto* invoker = findInvoker(hash.event))
+      if constexpr (isCategoryEnabled<Argument<Method>>())
       {
-        if (const auto disconnected = invoker->disconnect(i_object, hash.method); disconnected > 0)
+        const auto eventType = typeInfo<Argument<Method>, TypeIds>();
+        if (const auto routed = routedObjects.find(&i_object);
+                routed != end(routedObjects) &&
+                std::any_of(begin(routed->second), end(routed->second),
+                            [eventType](const auto& routedEventType)
+                            {
+                              return isRelated(routedEventType.typeInfo,
+                                               eventType);
+                            }))
         {
-          updateDependencies(i_object);
-          return disconnected;
+          throw std::invalid_argument(
+                  "HB4: object with keyed or filtered handlers can't have "
+                  "plain handlers for a base or a derived event type");
         }
+        invokerContainerImpl.connect(typeInfo<Argument<Method>, TypeIds>(),
+                                     Handler(i_object,
+                                             TemplateParameter<Method>(),
+                                             TypeIds(), i_options));
       }
-      return 0;
     }
 
-    std::unordered_map<TypeId, Invoker> invokers;
-    std::unordered_map<TypeId, std::vector<TypeId>> eventTypes;
-    std::unordered_map<TypeId, SimpleInvoker> simpleInvokers;
-    bool isInInvokeProcess = false;
-    bool dirty = false;
-    bool simpleInvokersUpdated = false;
-    size_t pos = 0;
-  };
+    template<typename Event>
+    inline void invoke(const Event& event, const ArrayView2<TypeId> eventType,
+                       ResultSink* sink)
+    {
+      const auto firstLevel = !isDispatching;
+      isDispatching = true;
+      // после исключения из обработчика контейнер выходит из доставки,
+      // а отложенные события отбрасываются
+      const ScopeExit dispatchExit([this, firstLevel]()
+                                   {
+                                     if (firstLevel && isDispatching)
+                                     {
+                                       deferredEvents.clear();
+                                       isDispatching = false;
+                                     }
+                                   });
+      // имя известно, только если тип события совпадает со статическим
+      const auto eventName = eventType.back() == TypeIds::template typeId<Event>() ?
+                             type_name<Event>() : std::string_view();
+      if (!invokerContainerImpl.invoke(&event, eventType, sink, eventName) &&
+          (!keyedInvokers.empty() || !filteredInvokers.empty()))
+      {
+        invokeRouted<Event>(event, sink);
+      }
+      if (firstLevel)
+      {
+        // события, отложенные обработчиками, в том числе во время разбора
+        // очереди; между событиями контейнер не в invoke и чистит списки
+        while (!deferredEvents.empty())
+        {
+          releaseFunctorSlots();
+          const auto deferredEvent = std::move(deferredEvents.front());
+          deferredEvents.pop_front();
+          deferredEvent->invoke(*this);
+        }
+        isDispatching = false;
+      }
+      releaseFunctorSlots();
+    }
+
+    struct IDeferredEvent
+    {
+      virtual ~IDeferredEvent() = default;
+      virtual void invoke(BasicInvokerContainer& container) const = 0;
+    };
 
-  struct InvokerContainer
-  {
     template<typename Event>
-    void invoke(const Event& event)
+    struct DeferredEvent : IDeferredEvent
+    {
+      explicit DeferredEvent(const Event& i_event): event(i_event)
+      {
+      }
+
+      void invoke(BasicInvokerContainer& container) const override
+      {
+        container.invoke<Event>(event, typeInfo<Event, TypeIds>(), nullptr);
+      }
+
+      Event event;
+    };
+
+    template<typename Event>
+    inline KeyedInvoker<RoutingKey<Event>>* findKeyedInvoker()
     {
-      static constexpr auto eventTypeInfo = collectBaseHashes<Event>();
-      invokerContainerImpl.invoke(&event, eventTypeInfo);
+      const auto it = keyedInvokers.find(TypeIds::template typeId<Event>());
+      return it == end(keyedInvokers) ? nullptr :
+             static_cast<KeyedInvoker<RoutingKey<Event>>*>(it->second.get());
     }
 
-    template<auto ...Methods>
-    void connect(Class<Methods...>& i_object, Register<Methods...>)
+    template<typename Event>
+    inline KeyedInvoker<RoutingKey<Event>>& getOrCreateKeyedInvoker()
     {
-      connect<Methods...>(i_object);
+      auto& keyedInvoker = keyedInvokers[TypeIds::template typeId<Event>()];
+      if (!keyedInvoker)
+      {
+        keyedInvoker = std::make_unique<KeyedInvoker<RoutingKey<Event>>>();
+      }
+      return static_cast<KeyedInvoker<RoutingKey<Event>>&>(*keyedInvoker);
     }
 
-    template<auto... Methods>
-    void connect(Class<Methods...>& i_object)
+    template<typename T, typename Event>
+    inline bool invokeRouted(const Event& event, ResultSink* sink)
+    {
+      if constexpr (HasRoutingKey<T>::value)
+      {
+        if (auto* keyedInvoker = findKeyedInvoker<T>();
+                keyedInvoker && keyedInvoker->invoke(
+                        event.*T::routingKey, &event, sink,
+                        invokerContainerImpl))
+        {
+          return true;
+        }
+      }
+      if (!filteredInvokers.empty())
+      {
+        // узлы unordered_map не перемещаются при вставке из обработчика
+        const auto it = filteredInvokers.find(TypeIds::template typeId<T>());
+        if (it != end(filteredInvokers) &&
+            it->second.invoke(&event, sink,
+                              invokerContainerImpl.getMutedGroups()))
+        {
+          return true;
+        }
+      }
+      if constexpr (HasBaseMember<T>::value)
+      {
+        return invokeRouted<typename T::Base>(event, sink);
+      }
+      return false;
+    }
+
+    static inline bool isRelated(const ArrayView2<TypeId> i_first,
+                                 const ArrayView2<TypeId> i_second)
     {
-      // создается временный array на который потом ссылаютя через arrayview
-      // нужно переделать
-      (invokerContainerImpl.connect(collectBaseHashes<Argument<Methods>>(),
-                                    Handler(i_object,
-                                            TemplateParameter<Methods>())), ...);
+      return isBaseOf(i_first, i_second) || isBaseOf(i_second, i_first);
     }
 
-    template<auto... Methods>
-    size_t disconnect(const Class<Methods...>& i_object)
+    // у объекта с обработчиками с ключом или фильтром нет обычных
+    // обработчиков родственных им типов, а сами их типы попарно
+    // не родственны
+    inline void checkRoutedConnect(const void* i_object,
+                                   const ArrayView2<TypeId> i_eventType)
     {
-      if constexpr(sizeof...(Methods) == 0)
+      if (invokerContainerImpl.hasRelatedHandlers(i_object, i_eventType))
       {
-        return invokerContainerImpl.disconnect(&i_object);
+        throw std::invalid_argument(
+                "HB4: object with plain handlers can't have keyed or "
+                "filtered handlers for a base or a derived event type");
+      }
+      const auto routed = routedObjects.find(i_object);
+      if (routed == end(routedObjects))
+      {
+        return;
+      }
+      for (const auto& eventType: routed->second)
+      {
+        if (isRelated(eventType.typeInfo, i_eventType))
+        {
+          throw std::invalid_argument(
+                  "HB4: keyed or filtered handlers of one object can't "
+                  "subscribe to a base and a derived event type");
+        }
+      }
+    }
+
+    inline void routedConnected(const void* i_object,
+                                const ArrayView2<TypeId> i_eventType)
+    {
+      auto& eventTypes = routedObjects[i_object];
+      const auto it = std::find_if(begin(eventTypes), end(eventTypes),
+                                   [i_eventType](const auto& eventType)
+                                   {
+                                     return eventType.typeInfo.back() ==
+                                            i_eventType.back();
+                                   });
+      if (it == end(eventTypes))
+      {
+        eventTypes.push_back(RoutedEventType{i_eventType, 1});
       }
       else
       {
-        return invokerContainerImpl.disconnect(&i_object, {EventMethodType{
-                TypeHash<Argument<Methods>>, ValueHash<Methods>}...});
+        ++it->handlers;
       }
+      invokerContainerImpl.registerType(i_eventType);
+      invokerContainerImpl.changeSubscribers(i_eventType.back(), 1);
+    }
+
+    template<auto Method>
+    inline size_t disconnectRouted(const Class<Method>& i_object)
+    {
+      const auto routed = routedObjects.find(&i_object);
+      if (routed == end(routedObjects))
+      {
+        return 0;
+      }
+      const auto eventTypeId = TypeIds::template typeId<Argument<Method>>();
+      const auto methodId = TypeIds::template methodId<Method>();
+      size_t disconnected = 0;
+      if (const auto it = keyedInvokers.find(eventTypeId);
+              it != end(keyedInvokers))
+      {
+        disconnected += routedDisconnected(
+                eventTypeId, it->second->disconnect(&i_object, methodId));
+      }
+      if (const auto it = filteredInvokers.find(eventTypeId);
+              it != end(filteredInvokers))
+      {
+        disconnected += routedDisconnected(
+                eventTypeId, it->second.disconnect(&i_object, methodId));
+      }
+      auto& eventTypes = routed->second;
+      const auto it = std::find_if(begin(eventTypes), end(eventTypes),
+                                   [eventTypeId](const auto& eventType)
+                                   {
+                                     return eventType.typeInfo.back() ==
+                                            eventTypeId;
+                                   });
+      if (it != end(eventTypes) && (it->handlers -= disconnected) == 0)
+      {
+        eventTypes.erase(it);
+      }
+      if (eventTypes.empty())
+      {
+        routedObjects.erase(routed);
+      }
+      if (disconnected > 0)
+      {
+        invokerContainerImpl.removeOrderings(&i_object, methodId);
+      }
+      return disconnected;
+    }
+
+    inline size_t routedDisconnected(const TypeId eventTypeId,
+                                     const size_t disconnected)
+    {
+      if (disconnected > 0)
+      {
+        invokerContainerImpl.changeSubscribers(
+                eventTypeId, -static_cast<ptrdiff_t>(disconnected));
+      }
+      return disconnected;
+    }
+
+    inline Slot& allocateFunctorSlot()
+    {
+      if (freeFunctorSlots.empty())
+      {
+        return functorSlots.emplace_back();
+      }
+      auto* slot = freeFunctorSlots.back();
+      freeFunctorSlots.pop_back();
+      return *slot;
+    }
+
+    inline void disconnectFunctor(Slot& slot)
+    {
+      invokerContainerImpl.disconnect(slot.storage);
+      releasedFunctorSlots.push_back(&slot);
+      releaseFunctorSlots();
+    }
+
+    // функтор может отключить сам себя во время вызова,
+    // разрушаем его только вне invoke
+    inline void releaseFunctorSlots()
+    {
+      if (releasedFunctorSlots.empty() || invokerContainerImpl.isInvoking())
+      {
+        return;
+      }
+      for (auto* slot: releasedFunctorSlots)
+      {
+        std::exchange(slot->destroy, nullptr)(slot->storage);
+        freeFunctorSlots.push_back(slot);
+      }
+      releasedFunctorSlots.clear();
     }
 
-  private:
     InvokerContainerImpl invokerContainerImpl;
+    std::unordered_map<TypeId, std::unique_ptr<IKeyedInvoker>> keyedInvokers;
+    std::unordered_map<TypeId, FilteredInvoker> filteredInvokers;
+    struct RoutedEventType
+    {
+      ArrayView2<TypeId> typeInfo;
+      size_t handlers;
+    };
+    // объекты с обработчиками с ключом или фильтром и типы их событий
+    std::unordered_map<const void*, std::vector<RoutedEventType>> routedObjects;
+    std::deque<Slot> functorSlots;
+    std::vector<Slot*> freeFunctorSlots;
+    std::vector<Slot*> releasedFunctorSlots;
+    std::deque<std::unique_ptr<IDeferredEvent>> deferredEvents;
+    DispatchMode dispatchMode = DispatchMode::DepthFirst;
+    bool isDispatching = false;
   };
-}
 
+  using InvokerContainer = BasicInvokerContainer<>;
+  using StableInvokerContainer =
+          BasicInvokerContainer<StableInvokerContainerTraits>;
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Лог-линейная (в стиле HDR) гистограмма задержек. Относительная погрешность
+// корзины - 1 / subBucketCount. Писатель один: record() и merge() в гистограмму
+// выполняются в одном потоке и стоят обычных relaxed загрузок и записей, без
+// locked инструкций. Гистограммы разных потоков или контейнеров объединяются
+// через merge() при снятии отчета. Количество - сумма корзин; читатели из других
+// потоков могут работать одновременно с писателем.
+struct LatencyHistogram
+{
+  static constexpr unsigned subBucketBits = 4;
+  static constexpr uint64_t subBucketCount = uint64_t(1) << subBucketBits;
+  static constexpr size_t bucketCount = 64 * subBucketCount;
+
+  // Дешевая метка времени: TSC на x86, наносекунды steady_clock на остальных.
+  static inline uint64_t now()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
+  // Наносекунд на тик now(), калибруется один раз.
+  static inline double nsPerTick()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    static const double value = []()
+    {
+      const auto beginTime = std::chrono::steady_clock::now();
+      const auto beginTicks = now();
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      const auto ticks = now() - beginTicks;
+      const auto ns = std::chrono::duration<double, std::nano>(
+              std::chrono::steady_clock::now() - beginTime).count();
+      return ticks == 0 ? 1.0 : ns / static_cast<double>(ticks);
+    }();
+    return value;
+#else
+    return 1.0;
+#endif
+  }
+
+  static constexpr size_t bucketIndex(const uint64_t i_value)
+  {
+    if (i_value < subBucketCount)
+    {
+      return static_cast<size_t>(i_value);
+    }
+#if defined(__clang__) || defined(__GNUC__)
+    const unsigned exponent = 63 - __builtin_clzll(i_value);
+#else
+    unsigned exponent = 63;
+    while (!(i_value >> exponent))
+    {
+      --exponent;
+    }
+#endif
+    const auto shift = exponent - subBucketBits;
+    return static_cast<size_t>((shift + 1) * subBucketCount +
+                               ((i_value >> shift) - subBucketCount));
+  }
+
+  // наименьшее значение, попадающее в корзину
+  static constexpr uint64_t bucketValue(const size_t i_index)
+  {
+    if (i_index < subBucketCount)
+    {
+      return i_index;
+    }
+    const auto shift = i_index / subBucketCount - 1;
+    return (subBucketCount + i_index % subBucketCount) << shift;
+  }
+
+  inline void record(const uint64_t i_value)
+  {
+    add(buckets[bucketIndex(i_value)], 1);
+    add(sum, i_value);
+    raiseMax(i_value);
+  }
+
+  inline void merge(const LatencyHistogram& i_other)
+  {
+    for (size_t i = 0; i < bucketCount; ++i)
+    {
+      if (const auto n = i_other.buckets[i].load(std::memory_order_relaxed))
+      {
+        add(buckets[i], n);
+      }
+    }
+    add(sum, i_other.sum.load(std::memory_order_relaxed));
+    raiseMax(i_other.getMax());
+  }
+
+  inline uint64_t getCount() const
+  {
+    uint64_t total = 0;
+    for (const auto& bucket: buckets)
+    {
+      total += bucket.load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+
+  inline uint64_t getMax() const
+  {
+    return max.load(std::memory_order_relaxed);
+  }
+
+  // i_quantile в [0, 1]; нижняя граница корзины, содержащей квантиль
+  inline uint64_t percentile(const double i_quantile) const
+  {
+    const auto total = getCount();
+    if (total == 0)
+    {
+      return 0;
+    }
+    auto rank = static_cast<uint64_t>(i_quantile * static_cast<double>(total));
+    rank = rank >= total ? total - 1 : rank;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < bucketCount; ++i)
+    {
+      seen += buckets[i].load(std::memory_order_relaxed);
+      if (seen > rank)
+      {
+        return bucketValue(i);
+      }
+    }
+    return getMax();
+  }
+
+  // {"count":..,"mean":..,"p50":..,"p99":..,"p999":..,"max":..,
+  //  "buckets":[[value,count],...]}, значения умножаются на i_scale
+  inline std::string toJson(const double i_scale = 1.0) const
+  {
+    const auto scaled = [i_scale](const double value)
+    {
+      return std::to_string(value * i_scale);
+    };
+    const auto total = getCount();
+    std::string json = "{\"count\":" + std::to_string(total);
+    json += ",\"mean\":" + scaled(
+            total == 0 ? 0.0 : static_cast<double>(
+                    sum.load(std::memory_order_relaxed)) /
+                               static_cast<double>(total));
+    json += ",\"p50\":" + scaled(static_cast<double>(percentile(0.5)));
+    json += ",\"p99\":" + scaled(static_cast<double>(percentile(0.99)));
+    json += ",\"p999\":" + scaled(static_cast<double>(percentile(0.999)));
+    json += ",\"max\":" + scaled(static_cast<double>(getMax()));
+    json += ",\"buckets\":[";
+    bool first = true;
+    for (size_t i = 0; i < bucketCount; ++i)
+    {
+      if (const auto n = buckets[i].load(std::memory_order_relaxed))
+      {
+        json += first ? "[" : ",[";
+        json += scaled(static_cast<double>(bucketValue(i))) + "," +
+                std::to_string(n) + "]";
+        first = false;
+      }
+    }
+    json += "]}";
+    return json;
+  }
+
+private:
+  // писатель один: атомики нужны лишь для гонок с читателями
+  static inline void add(std::atomic<uint64_t>& i_counter, const uint64_t i_value)
+  {
+    i_counter.store(i_counter.load(std::memory_order_relaxed) + i_value,
+                    std::memory_order_relaxed);
+  }
+
+  inline void raiseMax(const uint64_t i_value)
+  {
+    if (i_value > max.load(std::memory_order_relaxed))
+    {
+      max.store(i_value, std::memory_order_relaxed);
+    }
+  }
+
+  std::array<std::atomic<uint64_t>, bucketCount> buckets{};
+  std::atomic<uint64_t> sum{0};
+  std::atomic<uint64_t> max{0};
+};
@@ -0,0 +1,218 @@
+#pragma once
+
+#include "ArrayView.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+
+// массив с местом на N элементов внутри объекта: пока элементов не больше N,
+// память не выделяется; при росте элементы переносятся в память Allocator.
+// Только для тривиально копируемых T (ArrayView2, идентификаторы):
+// элементы копируются без конструкторов и не разрушаются
+template<typename T, std::size_t N, typename Allocator = std::allocator<T>>
+class SmallVector : private Allocator
+{
+  static_assert(std::is_trivially_copyable_v<T>);
+  static_assert(N > 0);
+
+  using AllocatorTraits = std::allocator_traits<Allocator>;
+
+public:
+  using value_type = T;
+  using allocator_type = Allocator;
+
+  SmallVector() = default;
+
+  explicit SmallVector(const Allocator& i_allocator): Allocator(i_allocator)
+  {
+  }
+
+  SmallVector(const SmallVector& i_other):
+          Allocator(AllocatorTraits::select_on_container_copy_construction(
+                  i_other.get_allocator()))
+  {
+    assign(i_other.begin(), i_other.end());
+  }
+
+  SmallVector(const SmallVector& i_other, const Allocator& i_allocator):
+          Allocator(i_allocator)
+  {
+    assign(i_other.begin(), i_other.end());
+  }
+
+  SmallVector(SmallVector&& i_other) noexcept: Allocator(i_other.get_allocator())
+  {
+    steal(i_other);
+  }
+
+  SmallVector& operator=(const SmallVector& i_other)
+  {
+    if (this != &i_other)
+    {
+      assign(i_other.begin(), i_other.end());
+    }
+    return *this;
+  }
+
+  // память другого распределителя не забирается, элементы копируются
+  SmallVector& operator=(SmallVector&& i_other)
+  {
+    if (this != &i_other)
+    {
+      if (!i_other.isInline() && get_allocator() == i_other.get_allocator())
+      {
+        release();
+        steal(i_other);
+      }
+      else
+      {
+        assign(i_other.begin(), i_other.end());
+        i_other.clear();
+      }
+    }
+    return *this;
+  }
+
+  ~SmallVector()
+  {
+    release();
+  }
+
+  template<typename It>
+  void assign(It i_first, It i_last)
+  {
+    const auto count = static_cast<std::size_t>(std::distance(i_first, i_last));
+    if (count > d_capacity)
+    {
+      release();
+      d_data = AllocatorTraits::allocate(allocator(), count);
+      d_capacity = static_cast<uint32_t>(count);
+    }
+    std::copy(i_first, i_last, d_data);
+    d_size = static_cast<uint32_t>(count);
+  }
+
+  void push_back(const T& i_value)
+  {
+    if (d_size == d_capacity)
+    {
+      reserve(std::size_t(d_capacity) * 2);
+    }
+    d_data[d_size++] = i_value;
+  }
+
+  void reserve(const std::size_t i_capacity)
+  {
+    if (i_capacity <= d_capacity)
+    {
+      return;
+    }
+    T* data = AllocatorTraits::allocate(allocator(), i_capacity);
+    std::copy(begin(), end(), data);
+    const auto size = d_size;
+    release();
+    d_data = data;
+    d_size = size;
+    d_capacity = static_cast<uint32_t>(i_capacity);
+  }
+
+  inline void clear()
+  {
+    d_size = 0;
+  }
+
+  inline std::size_t size() const
+  {
+    return d_size;
+  }
+
+  inline bool empty() const
+  {
+    return d_size == 0;
+  }
+
+  inline std::size_t capacity() const
+  {
+    return d_capacity;
+  }
+
+  // элементы лежат внутри объекта
+  inline bool isInline() const
+  {
+    return d_data == d_inline;
+  }
+
+  inline const T* data() const
+  {
+    return d_data;
+  }
+
+  inline const T* begin() const
+  {
+    return d_data;
+  }
+
+  inline const T* end() const
+  {
+    return d_data + d_size;
+  }
+
+  inline const T& operator[](const std::size_t i_pos) const
+  {
+    return d_data[i_pos];
+  }
+
+  inline operator ArrayView2<T>() const
+  {
+    return ArrayView2<T>(d_data, d_size);
+  }
+
+  inline allocator_type get_allocator() const
+  {
+    return static_cast<const Allocator&>(*this);
+  }
+
+private:
+  inline Allocator& allocator()
+  {
+    return static_cast<Allocator&>(*this);
+  }
+
+  void release()
+  {
+    if (!isInline())
+    {
+      AllocatorTraits::deallocate(allocator(), d_data, d_capacity);
+      d_data = d_inline;
+      d_capacity = N;
+    }
+    d_size = 0;
+  }
+
+  // i_other остается пустым и с местом внутри себя
+  void steal(SmallVector& i_other)
+  {
+    if (i_other.isInline())
+    {
+      std::copy(i_other.begin(), i_other.end(), d_inline);
+    }
+    else
+    {
+      d_data = i_other.d_data;
+      d_capacity = i_other.d_capacity;
+      i_other.d_data = i_other.d_inline;
+      i_other.d_capacity = N;
+    }
+    d_size = i_other.d_size;
+    i_other.d_size = 0;
+  }
+
+  T d_inline[N];
+  T* d_data = d_inline;
+  uint32_t d_size = 0;
+  uint32_t d_capacity = N;
+};
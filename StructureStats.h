@@ -0,0 +1,111 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// счетчик одной структурной операции контейнера (перестроение дерева
+// зависимостей, списков доставки, уплотнение массивов): число вызовов,
+// время и размер входа; что считается входом - описано у поля статистики
+struct OperationStats
+{
+  size_t count = 0;
+  uint64_t totalNs = 0;
+  uint64_t maxNs = 0;
+  size_t totalInput = 0;
+  size_t maxInput = 0;
+
+  inline void record(const uint64_t i_ns, const size_t i_input)
+  {
+    ++count;
+    totalNs += i_ns;
+    maxNs = i_ns > maxNs ? i_ns : maxNs;
+    totalInput += i_input;
+    maxInput = i_input > maxInput ? i_input : maxInput;
+  }
+
+  inline double meanNs() const
+  {
+    return count == 0 ? 0.0 : static_cast<double>(totalNs) /
+                              static_cast<double>(count);
+  }
+};
+
+// замер операции от создания до record: два чтения часов на структурную
+// операцию (в доставке без изменений их нет). При сборке с
+// STRUCTURE_STATS_NO_TIMING ведутся только число вызовов и размер входа,
+// поля времени остаются нулевыми, а StructureStats::timed - false
+struct OperationTimer
+{
+  explicit OperationTimer(OperationStats* i_stats)
+          : stats(i_stats)
+#ifndef STRUCTURE_STATS_NO_TIMING
+            , begin(i_stats ? std::chrono::steady_clock::now() :
+                    std::chrono::steady_clock::time_point())
+#endif
+  {
+  }
+
+  inline void record(const size_t i_input)
+  {
+    if (stats)
+    {
+#ifndef STRUCTURE_STATS_NO_TIMING
+      stats->record(static_cast<uint64_t>(
+                            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                    std::chrono::steady_clock::now() - begin).count()),
+                    i_input);
+#else
+      stats->record(0, i_input);
+#endif
+    }
+  }
+
+private:
+  OperationStats* stats;
+#ifndef STRUCTURE_STATS_NO_TIMING
+  std::chrono::steady_clock::time_point begin;
+#endif
+};
+
+// телеметрия структурных изменений контейнера (HB3 и HB4): сколько раз и
+// как долго перестраивались зависимости и списки доставки, на каком объеме
+// данных; поля списков доставки ведет только HB4
+struct StructureStats
+{
+  // false - время не измеряется (STRUCTURE_STATS_NO_TIMING), поля *Ns нулевые
+#ifdef STRUCTURE_STATS_NO_TIMING
+  static constexpr bool timed = false;
+#else
+  static constexpr bool timed = true;
+#endif
+  // вход - число узлов дерева типов объекта
+  OperationStats updateDependencies;
+  // вход - число просмотренных обработчиков
+  OperationStats makeInvokersTree;
+  // полное перестроение списков доставки; вход - число типов событий
+  OperationStats updateSimpleInvokers;
+  // дописывание новых обработчиков и перестроение устаревших списков;
+  // вход - число новых обработчиков и устаревших типов
+  OperationStats applyPendingChanges;
+  // перестроение устаревших списков внутри applyPendingChanges;
+  // вход - число перестроенных списков
+  OperationStats rebuildStale;
+  // удаление пустых Invoker; вход - число типов с обработчиками
+  OperationStats removeEmpty;
+  // удаление отключенных обработчиков из Invoker и списков доставки;
+  // вход - длина массива до уплотнения
+  OperationStats compaction;
+};
+
+// число узлов дерева типов, у узла - поддерево subTree
+template<typename Tree>
+size_t countNodes(const Tree& i_tree)
+{
+  size_t count = i_tree.size();
+  for (const auto& node: i_tree)
+  {
+    count += countNodes(node.subTree);
+  }
+  return count;
+}
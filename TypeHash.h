@@ -15,17 +15,81 @@ constexpr std::size_t fnv1a_64(std::string_view sv) noexcept
   return hash;
 }
 
-// Returns a constexpr hash for the type T.
-// Note: the exact value is implementation-defined (depends on compiler's
-// signature spelling) but stable within a toolchain and TU set.
+// Extracts "X" from a signature like "f() [with T = X; ...]" (gcc) or
+// "f() [T = X]" (clang). Other compilers get the whole signature.
+constexpr std::string_view template_argument_of(std::string_view signature) noexcept
+{
+#if defined(__clang__) || defined(__GNUC__)
+  const auto assignment = signature.find(" = ");
+  if (assignment == std::string_view::npos)
+  {
+    return signature;
+  }
+  const auto begin = assignment + 3;
+  auto end = signature.find(';', begin);
+  if (end == std::string_view::npos)
+  {
+    end = signature.rfind(']');
+  }
+  return signature.substr(begin, end - begin);
+#else
+  return signature;
+#endif
+}
+
+// Returns the compiler spelling of T, e.g. "HB2::Event1".
+// Same caveats as type_hash: stable within a toolchain.
 template<typename T>
-constexpr std::size_t type_hash() noexcept
+constexpr std::string_view type_name() noexcept
+{
+#if defined(__clang__) || defined(__GNUC__)
+  return template_argument_of({__PRETTY_FUNCTION__, sizeof(__PRETTY_FUNCTION__) - 1});
+#elif defined(_MSC_VER)
+  return {__FUNCSIG__, sizeof(__FUNCSIG__) - 1};
+#else
+  return {__func__, sizeof(__func__) - 1};
+#endif
+}
+
+// Returns the compiler spelling of a non-type template argument,
+// e.g. "& Handler::onTick". Same caveats as type_name.
+template<auto V>
+constexpr std::string_view value_name() noexcept
 {
 #if defined(__clang__) || defined(__GNUC__)
-  return fnv1a_64({__PRETTY_FUNCTION__, sizeof(__PRETTY_FUNCTION__) - 1});
+  return template_argument_of({__PRETTY_FUNCTION__, sizeof(__PRETTY_FUNCTION__) - 1});
 #elif defined(_MSC_VER)
-  return fnv1a_64({__FUNCSIG__, sizeof(__FUNCSIG__) - 1});
+  return {__FUNCSIG__, sizeof(__FUNCSIG__) - 1};
 #else
-      return fnv1a_64({__func__, sizeof(__func__) - 1});
+  return {__func__, sizeof(__func__) - 1};
 #endif
 }
+
+// True for spellings of types local to a translation unit: anonymous
+// namespaces, lambdas, unnamed classes and classes defined inside a function
+// ("f()::E" on gcc/clang, "`f'::`2'::E" on MSVC). Equal spellings of such
+// types in different TUs or modules may name different types (a static f()
+// in each TU), so the name (and its hash) can't identify them across modules.
+constexpr bool is_tu_local_name(std::string_view name) noexcept
+{
+  constexpr std::string_view markers[] = {
+          "{anonymous}", "(anonymous namespace)", "`anonymous namespace'",
+          "<lambda", "(lambda at ", "<unnamed", ")::", "'::`"};
+  for (const auto marker: markers)
+  {
+    if (name.find(marker) != std::string_view::npos)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns a constexpr hash for the type T.
+// Note: the exact value is implementation-defined (depends on compiler's
+// signature spelling) but stable within a toolchain and TU set.
+template<typename T>
+constexpr std::size_t type_hash() noexcept
+{
+  return fnv1a_64(type_name<T>());
+}
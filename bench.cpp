@@ -0,0 +1,230 @@
+#include "AllocationCounter.h"
+#include "HashBasedEventDispatcher2.h"
+#include "HashBasedEventDispatcher3.h"
+#include "HashBasedEventDispatcher4.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Замеры доставки HB4; не запускается из ctest.
+// Промахи предсказателя переходов читаются через perf_event_open (Linux),
+// при недоступности счетчиков выводится только время.
+
+namespace
+{
+  struct BranchMisses
+  {
+    BranchMisses()
+    {
+#if defined(__linux__)
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.size = sizeof(attr);
+      attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+
+    ~BranchMisses()
+    {
+#if defined(__linux__)
+      if (fd >= 0)
+      {
+        close(fd);
+      }
+#endif
+    }
+
+    inline bool isAvailable() const
+    {
+      return fd >= 0;
+    }
+
+    inline void start()
+    {
+#if defined(__linux__)
+      if (fd >= 0)
+      {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+#endif
+    }
+
+    inline uint64_t stop()
+    {
+      uint64_t count = 0;
+#if defined(__linux__)
+      if (fd >= 0)
+      {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != sizeof(count))
+        {
+          count = 0;
+        }
+      }
+#endif
+      return count;
+    }
+
+  private:
+    int fd = -1;
+  };
+
+  struct Tick
+  {
+    uint64_t value = 0;
+  };
+
+  template<int N>
+  struct Agent
+  {
+    uint64_t sum = 0;
+
+    void onTick(const Tick& tick)
+    {
+      sum += tick.value * N;
+    }
+  };
+
+  constexpr size_t handlersCount = 10000;
+  constexpr size_t eventsCount = 1000;
+
+  void run(const bool i_unordered)
+  {
+    std::vector<Agent<1>> agents1(handlersCount / 3 + 1);
+    std::vector<Agent<2>> agents2(handlersCount / 3 + 1);
+    std::vector<Agent<3>> agents3(handlersCount / 3 + 1);
+    HB4::InvokerContainer ic;
+    // классы перемежаются, как при подключении в порядке создания объектов
+    for (size_t i = 0; i < handlersCount / 3; ++i)
+    {
+      ic.connect<&Agent<1>::onTick>(agents1[i]);
+      ic.connect<&Agent<2>::onTick>(agents2[i]);
+      ic.connect<&Agent<3>::onTick>(agents3[i]);
+    }
+    ic.setUnorderedDispatch<Tick>(i_unordered);
+    ic.invoke(Tick{});
+
+    BranchMisses branchMisses;
+    const auto begin = std::chrono::steady_clock::now();
+    branchMisses.start();
+    for (size_t i = 0; i < eventsCount; ++i)
+    {
+      ic.invoke(Tick{i});
+    }
+    const auto misses = branchMisses.stop();
+    const auto elapsed = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - begin).count();
+
+    std::cout << (i_unordered ? "unordered" : "ordered  ") << ": "
+              << elapsed << " ms";
+    if (branchMisses.isAvailable())
+    {
+      std::cout << ", branch misses per handler call: "
+                << static_cast<double>(misses) /
+                   static_cast<double>(handlersCount * eventsCount);
+    }
+    std::cout << std::endl;
+  }
+
+  // стоимость записи в гистограммы задержек на одно событие
+  void runLatency()
+  {
+    constexpr size_t count = 1000000;
+    Agent<1> agent;
+    HB4::InvokerContainer ic;
+    ic.connect<&Agent<1>::onTick>(agent);
+    ic.invoke(Tick{});
+    // выключены, замер каждой доставки, выборка по умолчанию
+    const std::array<uint32_t, 3> samplings{0, 1, 16};
+    std::array<double, 3> elapsed;
+    for (size_t mode = 0; mode < samplings.size(); ++mode)
+    {
+      ic.setLatencyHistogramsEnabled(samplings[mode] != 0, samplings[mode]);
+      const auto begin = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < count; ++i)
+      {
+        ic.invoke(Tick{i});
+      }
+      elapsed[mode] = std::chrono::duration<double, std::nano>(
+              std::chrono::steady_clock::now() - begin).count() / count;
+    }
+    std::cout << "latency histograms: " << elapsed[0] << " ns/event off, "
+              << elapsed[1] << " ns/event every event, " << elapsed[2]
+              << " ns/event 1 of 16" << std::endl;
+  }
+
+  // выделения памяти на одно подключение, отключение и доставку;
+  // первая доставка после подключений считается отдельно
+  template<typename Container>
+  void runAllocations(const char* i_name)
+  {
+    constexpr size_t objectsCount = 100;
+    constexpr size_t invokesCount = 1000;
+    std::vector<Agent<1>> agents(objectsCount);
+    Container ic;
+
+    AllocationScope connects;
+    for (auto& agent: agents)
+    {
+      ic.template connect<&Agent<1>::onTick>(agent);
+    }
+    const auto connectAllocations = connects.count();
+
+    AllocationScope firstInvoke;
+    ic.invoke(Tick{});
+    const auto firstInvokeAllocations = firstInvoke.count();
+
+    AllocationScope invokes;
+    for (size_t i = 0; i < invokesCount; ++i)
+    {
+      ic.invoke(Tick{i});
+    }
+    const auto invokeAllocations = invokes.count();
+
+    AllocationScope disconnects;
+    for (auto& agent: agents)
+    {
+      ic.template disconnect<&Agent<1>::onTick>(agent);
+    }
+    const auto disconnectAllocations = disconnects.count();
+
+    std::cout << i_name << " allocations: "
+              << static_cast<double>(connectAllocations) / objectsCount
+              << " per connect, " << firstInvokeAllocations
+              << " on first invoke, "
+              << static_cast<double>(invokeAllocations) / invokesCount
+              << " per invoke, "
+              << static_cast<double>(disconnectAllocations) / objectsCount
+              << " per disconnect" << std::endl;
+  }
+}
+
+int main()
+{
+  std::cout << handlersCount << " handlers of 3 classes, " << eventsCount
+            << " events" << std::endl;
+  run(false);
+  run(true);
+  runLatency();
+  runAllocations<HB2::InvokerContainer>("HB2");
+  runAllocations<HB3::InvokerContainer>("HB3");
+  runAllocations<HB4::InvokerContainer>("HB4");
+  return 0;
+}
@@ -111,6 +111,10 @@ namespace HB
   struct Event3_1 : Inherit<Event2_1>{};
   struct Event4_1 : Inherit<Event3_1>{};
 
+  static_assert(has_unique_type_hashes(collect_type_hash_entries<
+          Event1, Event2, Event3, Event4,
+          Event1_1, Event2_1, Event3_1, Event4_1>()));
+
   struct HandlerBase : IHandler
   {
     void handle(const IEvent& i_event, ArrayView2<uint64_t> i_hashes) override
@@ -152,7 +152,7 @@ auto& get(T& t)
   }
   else
   {
-    static_assert(false);
+    static_assert(sizeof(T) == 0);
   }
 }
 
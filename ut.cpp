@@ -1,13 +1,23 @@
+#include "AllocationCounter.h"
+#include "CollectBaseHashes.h"
+#include "CompactInvokerContainer.h"
+#include "FixedInvokerContainer.h"
+#include "HashBasedEventDispatcher3.h"
 #include "HashBasedEventDispatcher4.h"
+#include "SmallVector.h"
+#include "ut_plugin.h"
 
 #include "struct_util.h"
 
 #include <functional>
+#include <memory_resource>
+#include <thread>
 #include <tuple>
 #include <utility>
 #include <numeric>
 
 #include <cxxabi.h>
+#include <dlfcn.h>
 
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 
@@ -288,4 +298,1938 @@ TEST_CASE("Hash based event dispatcher 4 complex test ")
     expected.log<&Handler2::onEvent2_1>(e);
     CHECK_EQ(logger.eventsLog, expected.eventsLog);
   }
-}
\ No newline at end of file
+}
+
+TEST_CASE("Hash based event dispatcher 4 dynamic invoke test ")
+{
+  struct EventBase : HB4::Dispatchable<EventBase>
+  {
+    int value = 0;
+    EventBase(int i_value): value(i_value){}
+    virtual ~EventBase(){};
+  };
+
+  struct Event1 : HB4::Dispatchable<Event1, EventBase>
+  {
+    using Dispatchable::Dispatchable;
+  };
+
+  struct Event1_1 : HB4::Dispatchable<Event1_1, Event1>
+  {
+    using Dispatchable::Dispatchable;
+  };
+
+  struct Handler
+  {
+    EventProcessingLogger& logger;
+
+    void onEventBase(const EventBase& event)
+    {
+      logger.log<&Handler::onEventBase>(event);
+    }
+
+    void onEvent1(const Event1& event)
+    {
+      logger.log<&Handler::onEvent1>(event);
+    }
+  };
+
+  EventProcessingLogger logger;
+  Handler handler{logger};
+  HB4::InvokerContainer ic;
+  ic.connect<&Handler::onEventBase, &Handler::onEvent1>(handler);
+
+  const Event1_1 e{7};
+  const EventBase& base = e;
+  // цепочка лежит в самом событии, а не за указателем
+  CHECK_EQ(base.getDynamicTypeInfo().begin(),
+           HB4::typeInfo<Event1_1>().begin());
+  CHECK_EQ(base.getDynamicTypeInfo().size(), 3);
+  ic.invokeDynamic(base);
+
+  const EventBase sliced = e;
+  ic.invokeDynamic(sliced);
+
+  EventProcessingLogger expected;
+  expected.log<&Handler::onEvent1>(e);
+  expected.log<&Handler::onEventBase>(sliced);
+  CHECK_EQ(logger.eventsLog, expected.eventsLog);
+}
+
+
+TEST_CASE("Hash based event dispatcher 4 stable type ids test ")
+{
+  SUBCASE("collision")
+  {
+    const auto id = HB4::internTypeId(1, "TypeA");
+    CHECK_EQ(HB4::internTypeId(1, "TypeA"), id);
+    CHECK_THROWS_AS(HB4::internTypeId(1, "TypeB"), std::logic_error);
+  }
+  SUBCASE("plugin")
+  {
+    struct Handler
+    {
+      int value = 0;
+
+      void onEvent(const PluginTest::PluginEvent& event)
+      {
+        value += event.value;
+      }
+    };
+
+    auto* plugin = dlopen(UT_PLUGIN_PATH, RTLD_NOW | RTLD_LOCAL);
+    REQUIRE_MESSAGE(plugin, dlerror());
+    const auto connectHandler = reinterpret_cast<PluginTest::ConnectHandler>(
+            dlsym(plugin, "connectHandler"));
+    const auto invokeEvent = reinterpret_cast<PluginTest::InvokeEvent>(
+            dlsym(plugin, "invokeEvent"));
+    const auto addressTypeId = reinterpret_cast<PluginTest::AddressTypeId>(
+            dlsym(plugin, "addressTypeId"));
+    REQUIRE(connectHandler);
+    REQUIRE(invokeEvent);
+    REQUIRE(addressTypeId);
+
+    // адресные идентификаторы в плагине свои
+    CHECK_NE(addressTypeId(),
+             HB4::AddressTypeIds::typeId<PluginTest::PluginEvent1>());
+
+    int pluginCounter = 0;
+    Handler handler;
+    HB4::StableInvokerContainer ic;
+    connectHandler(ic, pluginCounter);
+    ic.connect<&Handler::onEvent>(handler);
+
+    PluginTest::PluginEvent1 event;
+    event.value = 2;
+    ic.invoke(event);
+    invokeEvent(ic, 3);
+
+    CHECK_EQ(pluginCounter, 5);
+    CHECK_EQ(handler.value, 5);
+
+    ic.disconnect(handler);
+    dlclose(plugin);
+  }
+}
+
+
+namespace
+{
+  // так же называется обработчик в ut_plugin.cpp
+  struct PluginHandler
+  {
+    int value = 0;
+
+    void onEvent1(const PluginTest::PluginEvent1& event)
+    {
+      value += event.value;
+    }
+  };
+}
+
+TEST_CASE("Stable type ids of translation unit local types test ")
+{
+  using OnEvent1 = HB4::TemplateParameter<&PluginHandler::onEvent1>;
+  static_assert(is_tu_local_name(type_name<PluginHandler>()));
+  static_assert(!is_tu_local_name(type_name<PluginTest::PluginEvent1>()));
+  // в каждой единице трансляции своя статическая функция с таким именем
+  struct LocalEvent
+  {
+  };
+  static_assert(is_tu_local_name(type_name<LocalEvent>()));
+  CHECK_EQ(HB4::StableTypeIds::typeId<LocalEvent>(),
+           HB4::AddressTypeIds::typeId<LocalEvent>());
+
+  // не интернируется по имени: совпадение имен с типом плагина -
+  // не коллизия и не общий идентификатор
+  CHECK_EQ(HB4::StableTypeIds::methodId<&PluginHandler::onEvent1>(),
+           HB4::AddressTypeIds::typeId<OnEvent1>());
+  CHECK_NE(HB4::StableTypeIds::methodId<&PluginHandler::onEvent1>(),
+           HB4::internTypeId(type_hash<OnEvent1>(), type_name<OnEvent1>()));
+  CHECK_EQ(HB4::StableTypeIds::typeId<PluginTest::PluginEvent1>(),
+           HB4::internTypeId(type_hash<PluginTest::PluginEvent1>(),
+                             type_name<PluginTest::PluginEvent1>()));
+
+  void* plugin = dlopen(UT_PLUGIN_PATH, RTLD_NOW | RTLD_LOCAL);
+  REQUIRE(plugin);
+  const auto connectHandler = reinterpret_cast<PluginTest::ConnectHandler>(
+          dlsym(plugin, "connectHandler"));
+  REQUIRE(connectHandler);
+  int pluginCounter = 0;
+  PluginHandler handler;
+  HB4::StableInvokerContainer ic;
+  connectHandler(ic, pluginCounter);
+  ic.connect<&PluginHandler::onEvent1>(handler);
+  PluginTest::PluginEvent1 event;
+  event.value = 2;
+  ic.invoke(event);
+  // отключается только свой обработчик
+  CHECK_EQ(ic.disconnect<&PluginHandler::onEvent1>(handler), 1);
+  ic.invoke(event);
+  CHECK_EQ(handler.value, 2);
+  CHECK_EQ(pluginCounter, 4);
+  dlclose(plugin);
+}
+
+TEST_CASE("Type hash collision audit test ")
+{
+  struct EventBase{};
+
+  struct Event1 : EventBase
+  {
+    using Base = EventBase;
+  };
+
+  struct Event1_1 : Event1
+  {
+    using Base = Event1;
+  };
+
+  struct Event2 : EventBase
+  {
+    using Base = EventBase;
+  };
+
+  constexpr auto entries =
+          collect_type_hash_entries<Event1_1, Event2, PluginTest::PluginEvent1>();
+  static_assert(entries.size() == 7);
+  static_assert(has_unique_type_hashes(entries));
+  CHECK_EQ(entries[0].name, type_name<Event1_1>());
+  CHECK_EQ(entries[2].name, type_name<EventBase>());
+
+  constexpr std::array<type_hash_entry, 3> collision{
+          type_hash_entry{1, "A"}, type_hash_entry{2, "B"},
+          type_hash_entry{1, "C"}};
+  static_assert(find_type_hash_collision(collision) == 0);
+  static_assert(!has_unique_type_hashes(collision));
+}
+
+
+namespace
+{
+  int freeFunctionSum = 0;
+
+  void onFreeFunctionEvent(const PluginTest::PluginEvent& event)
+  {
+    freeFunctionSum += event.value;
+  }
+}
+
+TEST_CASE("Hash based event dispatcher 4 functor handlers test ")
+{
+  struct StatelessFunctor
+  {
+    void operator()(const PluginTest::PluginEvent1& event) const
+    {
+      freeFunctionSum -= event.value;
+    }
+  };
+
+  freeFunctionSum = 0;
+  int lambdaSum = 0;
+  int calls = 0;
+  HB4::InvokerContainer ic;
+  auto lambdaConnection = ic.connect(
+          [&lambdaSum, &calls](const PluginTest::PluginEvent& event)
+          {
+            lambdaSum += event.value;
+            ++calls;
+          });
+  auto functionConnection = ic.connect(&onFreeFunctionEvent);
+  auto functorConnection = ic.connect(StatelessFunctor());
+
+  PluginTest::PluginEvent1 event;
+  event.value = 3;
+  ic.invoke(event);
+  CHECK_EQ(lambdaSum, 3);
+  CHECK_EQ(freeFunctionSum, 0);
+
+  functorConnection.disconnect();
+  ic.invoke(event);
+  CHECK_EQ(lambdaSum, 6);
+  CHECK_EQ(freeFunctionSum, 3);
+
+  {
+    const auto moved = std::move(functionConnection);
+    CHECK_FALSE(functionConnection.isConnected());
+  }
+  ic.invoke(event);
+  CHECK_EQ(freeFunctionSum, 3);
+
+  lambdaConnection.disconnect();
+  ic.invoke(event);
+  CHECK_EQ(lambdaSum, 9);
+
+  // функтор отключает сам себя во время вызова
+  HB4::ScopedConnection self;
+  self = ic.connect([&self, &calls](const PluginTest::PluginEvent&)
+                    {
+                      ++calls;
+                      self.disconnect();
+                    });
+  ic.invoke(event);
+  ic.invoke(event);
+  CHECK_EQ(calls, 4);
+}
+
+TEST_CASE("Hash based event dispatcher 4 consumed events test ")
+{
+  struct KeyEvent
+  {
+    int value = 0;
+  };
+
+  struct Handler
+  {
+    std::vector<int> log;
+
+    bool onFirst(const KeyEvent& event)
+    {
+      log.push_back(1);
+      return event.value == 1;
+    }
+
+    HandleResult onSecond(const KeyEvent& event)
+    {
+      log.push_back(2);
+      return event.value == 2 ? HandleResult::Consumed : HandleResult::Ignored;
+    }
+  };
+
+  struct LastHandler
+  {
+    std::vector<int>& log;
+
+    void onEvent(const KeyEvent&)
+    {
+      log.push_back(3);
+    }
+  };
+
+  Handler handler;
+  LastHandler lastHandler{handler.log};
+  HB4::InvokerContainer ic;
+  ic.connect<&Handler::onFirst, &Handler::onSecond>(handler);
+  ic.connect<&LastHandler::onEvent>(lastHandler);
+
+  ic.invoke(KeyEvent{1});
+  CHECK_EQ(handler.log, std::vector<int>{1});
+  handler.log.clear();
+
+  ic.invoke(KeyEvent{2});
+  CHECK_EQ(handler.log, std::vector<int>{1, 2});
+  handler.log.clear();
+
+  ic.invoke(KeyEvent{3});
+  CHECK_EQ(handler.log, std::vector<int>{1, 2, 3});
+}
+
+TEST_CASE("Hash based event dispatcher 4 result collecting test ")
+{
+  struct Query
+  {
+    int value = 0;
+  };
+
+  struct Server
+  {
+    int id = 0;
+    int load = 0;
+
+    int onLoad(const Query&)
+    {
+      return load;
+    }
+
+    std::optional<int> onServe(const Query& query) const
+    {
+      return query.value == id ? std::optional<int>(id) : std::nullopt;
+    }
+  };
+
+  struct Logger
+  {
+    int calls = 0;
+
+    void onQuery(const Query&)
+    {
+      ++calls;
+    }
+  };
+
+  Server s1{1, 10};
+  Server s2{2, 30};
+  Logger logger;
+  HB4::InvokerContainer ic;
+  ic.connect<&Server::onLoad>(s1);
+  ic.connect<&Logger::onQuery>(logger);
+  ic.connect<&Server::onLoad>(s2);
+
+  HB4::Sum<int> sum;
+  CHECK_EQ(ic.invoke(Query{}, sum), 0);
+  CHECK_EQ(sum.value, 40);
+
+  // результаты int приводятся к Value коллектора
+  HB4::Sum<double> doubleSum;
+  CHECK_EQ(ic.invoke(Query{}, doubleSum), 0);
+  CHECK_EQ(doubleSum.value, 40.0);
+
+  HB4::Max<int> max;
+  ic.invoke(Query{}, max);
+  CHECK_EQ(max.value, std::optional<int>(30));
+
+  std::array<int, 1> buffer{};
+  HB4::IntoBuffer<int> intoBuffer{buffer.data(), buffer.size()};
+  ic.invoke(Query{}, intoBuffer);
+  CHECK_EQ(intoBuffer.size, 1);
+  CHECK_EQ(buffer[0], 10);
+  // заполненный коллектор отбрасывает результаты, доставка продолжается
+  CHECK_EQ(logger.calls, 4);
+
+  HB4::InvokerContainer servers;
+  const auto c1 = servers.connect([&s1](const Query& query)
+                                  {
+                                    return s1.onServe(query);
+                                  });
+  const auto c2 = servers.connect([&s2](const Query& query)
+                                  {
+                                    return s2.onServe(query);
+                                  });
+  HB4::FirstNonEmpty<int> first;
+  servers.invoke(Query{2}, first);
+  CHECK_EQ(first.value, std::optional<int>(2));
+  // std::optional<int> не приводится к std::optional<long>
+  HB4::FirstNonEmpty<long> mismatched;
+  CHECK_EQ(servers.invoke(Query{2}, mismatched), 2);
+  CHECK_FALSE(mismatched.value.has_value());
+  ic.invoke(Query{});
+  CHECK_EQ(logger.calls, 5);
+}
+
+namespace
+{
+  struct Tick
+  {
+    int symbol = 0;
+    int value = 0;
+    unsigned flags = 0;
+    static constexpr auto routingKey = &Tick::symbol;
+  };
+
+  struct Trade : Tick
+  {
+    using Base = Tick;
+  };
+
+  struct Quote : Trade
+  {
+    using Base = Trade;
+  };
+
+  struct Heartbeat
+  {
+    int source = 0;
+    static constexpr auto routingKey = &Heartbeat::source;
+  };
+
+  // цепочка глубиной N + 2
+  template<int N>
+  struct DeepTick : DeepTick<N - 1>
+  {
+    using Base = DeepTick<N - 1>;
+  };
+
+  template<>
+  struct DeepTick<0> : Tick
+  {
+    using Base = Tick;
+  };
+
+  struct DebugTick : Tick
+  {
+    using Base = Tick;
+    static constexpr auto category = HB4::Category::Debug;
+  };
+
+  struct TraceTick : Tick
+  {
+    using Base = Tick;
+    static constexpr auto category = HB4::Category::Trace;
+  };
+}
+
+TEST_CASE("Hash based event dispatcher 4 keyed routing test ")
+{
+  struct Handler
+  {
+    std::vector<int> log;
+
+    void onTick(const Tick& tick)
+    {
+      log.push_back(tick.value);
+    }
+  };
+
+  Handler h1;
+  Handler h2;
+  Handler all;
+  HB4::InvokerContainer ic;
+  ic.connect<&Handler::onTick>(h1, 1);
+  ic.connect<&Handler::onTick>(h2, 2);
+  ic.connect<&Handler::onTick>(all);
+
+  ic.invoke(Tick{1, 10});
+  ic.invoke(Tick{2, 20});
+  ic.invoke(Tick{3, 30});
+  Trade trade;
+  trade.symbol = 2;
+  trade.value = 40;
+  ic.invoke(trade);
+
+  CHECK_EQ(h1.log, std::vector<int>{10});
+  CHECK_EQ(h2.log, std::vector<int>{20, 40});
+  CHECK_EQ(all.log, std::vector<int>{10, 20, 30, 40});
+
+  CHECK_EQ(ic.disconnect<&Handler::onTick>(h2), 1);
+  CHECK_EQ(ic.disconnect(h1), 1);
+  ic.invoke(Tick{1, 50});
+  ic.invoke(Tick{2, 60});
+  CHECK_EQ(h1.log, std::vector<int>{10});
+  CHECK_EQ(h2.log, std::vector<int>{20, 40});
+  CHECK_EQ(all.log, std::vector<int>{10, 20, 30, 40, 50, 60});
+}
+
+TEST_CASE("Hash based event dispatcher 4 filter test ")
+{
+  struct Handler
+  {
+    std::vector<int> log;
+
+    void onTick(const Tick& tick)
+    {
+      log.push_back(tick.value);
+    }
+  };
+
+  Handler big;
+  Handler small;
+  Handler flagged;
+  HB4::InvokerContainer ic;
+  ic.connect<&Handler::onTick>(big, HB4::Filter<&Tick::value>{HB4::FilterOp::Greater, 25});
+  ic.connect<&Handler::onTick>(small, HB4::Filter<&Tick::value>{HB4::FilterOp::LessEqual, 10});
+  ic.connect<&Handler::onTick>(flagged, HB4::Filter<&Tick::flags>{HB4::FilterOp::AllBits, 0b101u});
+
+  ic.invoke(Tick{1, 10, 0b111});
+  ic.invoke(Tick{1, 20, 0b001});
+  ic.invoke(Tick{1, 30, 0b100});
+  Trade trade;
+  trade.value = 40;
+  trade.flags = 0b101;
+  ic.invoke(trade);
+
+  CHECK_EQ(big.log, std::vector<int>{30, 40});
+  CHECK_EQ(small.log, std::vector<int>{10});
+  CHECK_EQ(flagged.log, std::vector<int>{10, 40});
+
+  struct FloatEvent
+  {
+    double value = 0;
+  };
+  struct FloatHandler
+  {
+    void on(const FloatEvent&)
+    {}
+  };
+  FloatHandler floatHandler;
+  CHECK_THROWS_AS((ic.connect<&FloatHandler::on>(floatHandler, HB4::Filter<&FloatEvent::value>{HB4::FilterOp::AnyBits, 1.0})),
+                  std::invalid_argument);
+
+  CHECK_EQ(ic.disconnect<&Handler::onTick>(big), 1);
+  CHECK_EQ(ic.disconnect(flagged), 1);
+  ic.invoke(Tick{1, 50, 0b101});
+  ic.invoke(Tick{1, 5, 0b101});
+  CHECK_EQ(big.log, std::vector<int>{30, 40});
+  CHECK_EQ(small.log, std::vector<int>{10, 5});
+  CHECK_EQ(flagged.log, std::vector<int>{10, 40});
+}
+
+TEST_CASE("Hash based event dispatcher 4 routed handlers test ")
+{
+  std::vector<int> order;
+
+  struct Handler
+  {
+    std::vector<int>* order;
+    int id;
+
+    void onTick(const Tick&)
+    {
+      order->push_back(id);
+    }
+
+    void onTrade(const Trade&)
+    {
+      order->push_back(-id);
+    }
+
+    void onHeartbeat(const Heartbeat&)
+    {
+      order->push_back(id * 10);
+    }
+  };
+
+  // прошедшие фильтры обработчики вызываются в порядке подключения,
+  // а не по колонкам полей и операций
+  Handler h1{&order, 1};
+  Handler h2{&order, 2};
+  Handler h3{&order, 3};
+  HB4::InvokerContainer ic;
+  ic.connect<&Handler::onTick>(h1, HB4::Filter<&Tick::flags>{HB4::FilterOp::AnyBits, 1u});
+  ic.connect<&Handler::onTick>(h2, HB4::Filter<&Tick::value>{HB4::FilterOp::Greater, 0});
+  ic.connect<&Handler::onTick>(h3, HB4::Filter<&Tick::flags>{HB4::FilterOp::Equal, 1u});
+  ic.invoke(Tick{0, 1, 1});
+  CHECK_EQ(order, std::vector<int>{1, 2, 3});
+
+  // обычные обработчики и обработчики с ключом или фильтром одного
+  // объекта, как и последние между собой, не подписываются на
+  // родственные типы событий
+  Handler plain{&order, 4};
+  ic.connect<&Handler::onTick>(plain);
+  CHECK_THROWS_AS(ic.connect<&Handler::onTrade>(plain, 1), std::invalid_argument);
+  CHECK_THROWS_AS(ic.connect<&Handler::onTrade>(h1), std::invalid_argument);
+  CHECK_THROWS_AS(ic.connect<&Handler::onTrade>(h1, 1), std::invalid_argument);
+  ic.connect<&Handler::onTick>(h1, 1);
+
+  // на неродственные типы - подписываются
+  ic.connect<&Handler::onHeartbeat>(plain, 7);
+  ic.connect<&Handler::onHeartbeat>(h3);
+  order.clear();
+  ic.invoke(Heartbeat{7});
+  CHECK_EQ(order, std::vector<int>{30, 40});
+  CHECK_EQ(ic.disconnect<&Handler::onHeartbeat>(plain), 1);
+  // отключение объекта снимает и те, и другие
+  CHECK_EQ(ic.disconnect(h3), 2);
+  CHECK_FALSE(ic.hasSubscribers<Heartbeat>());
+
+  order.clear();
+  Trade trade;
+  trade.symbol = 1;
+  trade.value = 1;
+  ic.invoke(trade);
+  CHECK_EQ(order, std::vector<int>{4, 1, 2});
+
+  // после отключения объект снова свободен
+  CHECK_EQ(ic.disconnect(h1), 2);
+  ic.connect<&Handler::onTick>(h1);
+  CHECK_EQ(ic.disconnect<&Handler::onTick>(h2), 1);
+  ic.connect<&Handler::onTrade>(h2, 1);
+  order.clear();
+  ic.invoke(trade);
+  CHECK_EQ(order, std::vector<int>{4, 1, -2});
+}
+
+TEST_CASE("Hash based event dispatcher 4 handler groups test ")
+{
+  struct Handler
+  {
+    std::vector<int> log;
+
+    void onTick(const Tick& tick)
+    {
+      log.push_back(tick.value);
+    }
+  };
+
+  const HB4::Group replay{1};
+  Handler plain;
+  Handler grouped;
+  Handler keyed;
+  Handler filtered;
+  int functorCalls = 0;
+  HB4::InvokerContainer ic;
+  ic.connect<&Handler::onTick>(plain);
+  ic.connect<&Handler::onTick>(grouped, replay);
+  ic.connect<&Handler::onTick>(keyed, 1, replay);
+  ic.connect<&Handler::onTick>(filtered, HB4::Filter<&Tick::value>{HB4::FilterOp::Greater, 0}, replay);
+  const auto connection = ic.connect([&functorCalls](const Tick&)
+                                     {
+                                       ++functorCalls;
+                                     }, replay);
+
+  ic.invoke(Tick{1, 10});
+  ic.setGroupEnabled(replay, false);
+  ic.invoke(Tick{1, 20});
+  ic.setGroupEnabled(replay, true);
+  ic.invoke(Tick{1, 30});
+
+  CHECK_EQ(plain.log, std::vector<int>{10, 20, 30});
+  CHECK_EQ(grouped.log, std::vector<int>{10, 30});
+  CHECK_EQ(keyed.log, std::vector<int>{10, 30});
+  CHECK_EQ(filtered.log, std::vector<int>{10, 30});
+  CHECK_EQ(functorCalls, 2);
+  CHECK_THROWS_AS(ic.setGroupEnabled(HB4::Group{64}, false), std::invalid_argument);
+}
+
+TEST_CASE("Hash based event dispatcher 4 handler ordering test ")
+{
+  std::vector<int> order;
+
+  struct Handler
+  {
+    std::vector<int>* order;
+    int id;
+
+    void onTick(const Tick&)
+    {
+      order->push_back(id);
+    }
+  };
+
+  Handler h1{&order, 1};
+  Handler h2{&order, 2};
+  Handler h3{&order, 3};
+  Handler h4{&order, 4};
+  HB4::InvokerContainer ic;
+  ic.connect<&Handler::onTick>(h1);
+  ic.connect<&Handler::onTick>(h2);
+  ic.connect<&Handler::onTick>(h3, HB4::Priority{10});
+  ic.connect<&Handler::onTick>(h4, {HB4::Group{0}, HB4::Priority{-1}});
+
+  ic.invoke(Tick{});
+  CHECK_EQ(order, std::vector<int>{3, 1, 2, 4});
+
+  order.clear();
+  ic.addOrdering<&Handler::onTick, &Handler::onTick>(h4, h1);
+  ic.addOrdering<&Handler::onTick, &Handler::onTick>(h2, h3);
+  ic.invoke(Tick{});
+  CHECK_EQ(order, std::vector<int>{2, 3, 4, 1});
+
+  CHECK_THROWS_AS((ic.addOrdering<&Handler::onTick, &Handler::onTick>(h3, h2)),
+                  std::logic_error);
+  order.clear();
+  ic.invoke(Tick{});
+  CHECK_EQ(order, std::vector<int>{2, 3, 4, 1});
+
+  // ограничения отключенных обработчиков не достаются объектам,
+  // подключенным по тому же адресу
+  CHECK_EQ(ic.disconnect(h1), 1);
+  CHECK_EQ(ic.disconnect<&Handler::onTick>(h2), 1);
+  ic.connect<&Handler::onTick>(h1);
+  ic.connect<&Handler::onTick>(h2);
+  ic.addOrdering<&Handler::onTick, &Handler::onTick>(h1, h4);
+  ic.addOrdering<&Handler::onTick, &Handler::onTick>(h3, h2);
+  order.clear();
+  ic.invoke(Tick{});
+  CHECK_EQ(order, std::vector<int>{3, 1, 2, 4});
+}
+
+TEST_CASE("Hash based event dispatcher 4 unordered dispatch test ")
+{
+  std::vector<int> order;
+
+  struct HandlerA
+  {
+    std::vector<int>* order;
+    int id;
+
+    void onTick(const Tick&)
+    {
+      order->push_back(id);
+    }
+  };
+
+  struct HandlerB
+  {
+    std::vector<int>* order;
+    int id;
+
+    void onTick(const Tick&)
+    {
+      order->push_back(id);
+    }
+  };
+
+  HandlerA a1{&order, 1};
+  HandlerB b2{&order, 2};
+  HandlerA a3{&order, 3};
+  HandlerB b4{&order, 4};
+  HB4::InvokerContainer ic;
+  ic.connect<&HandlerA::onTick>(a1);
+  ic.connect<&HandlerB::onTick>(b2);
+  ic.connect<&HandlerA::onTick>(a3);
+  ic.connect<&HandlerB::onTick>(b4);
+
+  ic.setUnorderedDispatch<Tick>();
+  ic.invoke(Tick{});
+  // порядок групп зависит от адресов функций, внутри группы - подключение
+  const auto grouped = order == std::vector<int>{1, 3, 2, 4} ||
+                       order == std::vector<int>{2, 4, 1, 3};
+  CHECK(grouped);
+
+  order.clear();
+  ic.setUnorderedDispatch<Tick>(false);
+  ic.invoke(Tick{});
+  CHECK_EQ(order, std::vector<int>{1, 2, 3, 4});
+}
+
+TEST_CASE("Hash based event dispatcher 4 object range test ")
+{
+  struct Agent
+  {
+    int sum = 0;
+    int trades = 0;
+
+    void onTick(const Tick& tick)
+    {
+      sum += tick.value;
+    }
+
+    void onTrade(const Trade&)
+    {
+      ++trades;
+    }
+  };
+
+  std::vector<Agent> agents(4);
+  Agent single;
+  HB4::InvokerContainer ic;
+  ic.connect<&Agent::onTick>(single);
+  auto range = ic.connectRange<&Agent::onTick, &Agent::onTrade>(agents.data(), 3);
+
+  ic.invoke(Tick{0, 5});
+  Trade trade;
+  trade.value = 7;
+  ic.invoke(trade);
+
+  CHECK_EQ(agents[0].sum, 5);
+  CHECK_EQ(agents[2].sum, 5);
+  CHECK_EQ(agents[2].trades, 1);
+  CHECK_EQ(agents[3].sum, 0);
+  CHECK_EQ(single.sum, 12);
+
+  range.resize(agents.data(), agents.size());
+  CHECK_EQ(range.size(), 4);
+  ic.invoke(Tick{0, 1});
+  CHECK_EQ(agents[0].sum, 6);
+  CHECK_EQ(agents[3].sum, 1);
+  CHECK_EQ(single.sum, 13);
+
+  range.disconnect();
+  CHECK_FALSE(range.isConnected());
+  ic.invoke(Tick{0, 1});
+  CHECK_EQ(agents[0].sum, 6);
+  CHECK_EQ(single.sum, 14);
+
+  // набор меняется из своего же обработчика: текущая доставка идет по
+  // старому набору целиком, новый виден со следующей
+  struct Grower
+  {
+    HB4::RangeConnection<Grower>* range = nullptr;
+    std::vector<Grower>* next = nullptr;
+    int calls = 0;
+
+    void onTick(const Tick&)
+    {
+      ++calls;
+      if (range)
+      {
+        std::exchange(range, nullptr)->resize(next->data(), next->size());
+      }
+    }
+  };
+
+  std::vector<Grower> first(3);
+  std::vector<Grower> second(3);
+  auto growing = ic.connectRange<&Grower::onTick>(first.data(), 1);
+  first[0].range = &growing;
+  first[0].next = &second;
+  ic.invoke(Tick{});
+  CHECK_EQ(first[0].calls, 1);
+  CHECK_EQ(first[1].calls, 0);
+  CHECK_EQ(second[0].calls, 0);
+  ic.invoke(Tick{});
+  CHECK_EQ(first[0].calls, 1);
+  CHECK_EQ(second[0].calls, 1);
+  CHECK_EQ(second[2].calls, 1);
+}
+
+TEST_CASE("Hash based event dispatcher 4 deferred dispatch test ")
+{
+  struct Emitter
+  {
+    HB4::InvokerContainer* ic;
+    std::vector<int>* log;
+
+    void onTick(const Tick& tick)
+    {
+      log->push_back(tick.value);
+      if (tick.value < 3)
+      {
+        ic->invoke(Tick{0, tick.value * 10 + 1});
+        ic->invoke(Tick{0, tick.value * 10 + 2});
+      }
+    }
+  };
+
+  struct Listener
+  {
+    std::vector<int>* log;
+
+    void onTick(const Tick& tick)
+    {
+      log->push_back(-tick.value);
+    }
+  };
+
+  std::vector<int> log;
+  HB4::InvokerContainer ic;
+  Emitter emitter{&ic, &log};
+  Listener listener{&log};
+  ic.connect<&Emitter::onTick>(emitter);
+  ic.connect<&Listener::onTick>(listener);
+
+  ic.invoke(Tick{0, 0});
+  CHECK_EQ(log, std::vector<int>{0, 1, 11, -11, 12, -12, -1, 2, 21, -21, 22, -22, -2, -0});
+
+  log.clear();
+  ic.setDispatchMode(HB4::DispatchMode::Deferred);
+  ic.invoke(Tick{0, 0});
+  CHECK_EQ(log, std::vector<int>{0, -0, 1, -1, 2, -2, 11, -11, 12, -12, 21, -21, 22, -22});
+
+  // исключение из обработчика не оставляет контейнер в доставке:
+  // отложенные им события отбрасываются, следующие доставляются
+  struct Thrower
+  {
+    HB4::InvokerContainer* ic;
+
+    void onTrade(const Trade&)
+    {
+      ic->invoke(Tick{0, 5});
+      throw std::runtime_error("HB4 test: handler failed");
+    }
+  };
+
+  Thrower thrower{&ic};
+  ic.connect<&Thrower::onTrade>(thrower);
+  Trade trade;
+  trade.value = 3;
+  log.clear();
+  CHECK_THROWS_AS(ic.invoke(trade), std::runtime_error);
+  CHECK_EQ(log, std::vector<int>{3, -3});
+  log.clear();
+  ic.invoke(Tick{0, 4});
+  CHECK_EQ(log, std::vector<int>{4, -4});
+}
+
+TEST_CASE("Hash based event dispatcher 4 changes during dispatch test ")
+{
+  struct Handler
+  {
+    std::vector<int>* log;
+    int id;
+    std::function<void()> action;
+
+    void onTick(const Tick&)
+    {
+      log->push_back(id);
+      if (action)
+      {
+        std::exchange(action, nullptr)();
+      }
+    }
+
+    void onTrade(const Trade&)
+    {
+      log->push_back(id * 10);
+    }
+  };
+
+  std::vector<int> log;
+  HB4::InvokerContainer ic;
+  Handler h1{&log, 1, {}};
+  Handler h2{&log, 2, {}};
+  Handler h3{&log, 3, {}};
+  ic.connect<&Handler::onTick>(h1);
+  ic.connect<&Handler::onTick>(h2);
+  ic.invoke(Tick{});
+
+  // отключенный во время доставки обработчик уже не вызывается,
+  // подключенный - вызывается со следующей доставки
+  h1.action = [&ic, &h2, &h3]()
+  {
+    ic.disconnect(h2);
+    ic.connect<&Handler::onTick>(h3);
+  };
+  log.clear();
+  ic.invoke(Tick{});
+  CHECK_EQ(log, std::vector<int>{1});
+  log.clear();
+  ic.invoke(Tick{});
+  CHECK_EQ(log, std::vector<int>{1, 3});
+
+  // после отключения метода для производного события снова вызывается
+  // обработчик базового
+  ic.connect<&Handler::onTrade>(h3);
+  log.clear();
+  ic.invoke(Trade{});
+  CHECK_EQ(log, std::vector<int>{1, 30});
+  CHECK_EQ(ic.disconnect<&Handler::onTrade>(h3), 1);
+  log.clear();
+  ic.invoke(Trade{});
+  CHECK_EQ(log, std::vector<int>{1, 3});
+}
+
+TEST_CASE("Hash based event dispatcher 4 subscribers presence test ")
+{
+  struct TraceEvent
+  {
+    explicit TraceEvent(int& i_constructed, const int i_value): value(i_value)
+    {
+      ++i_constructed;
+    }
+
+    int value;
+  };
+
+  struct Handler
+  {
+    std::vector<int> log;
+
+    void onTick(const Tick& tick)
+    {
+      log.push_back(tick.value);
+    }
+
+    void onTrace(const TraceEvent& event)
+    {
+      log.push_back(event.value);
+    }
+  };
+
+  int constructed = 0;
+  Handler h;
+  HB4::InvokerContainer ic;
+  CHECK_FALSE(ic.hasSubscribers<Tick>());
+  CHECK_FALSE(ic.hasSubscribers<Trade>());
+  ic.emit<TraceEvent>(constructed, 1);
+  CHECK_EQ(constructed, 0);
+
+  ic.connect<&Handler::onTick>(h);
+  ic.connect<&Handler::onTrace>(h);
+  CHECK(ic.hasSubscribers<Tick>());
+  CHECK(ic.hasSubscribers<Trade>());
+  ic.emit<TraceEvent>(constructed, 2);
+  ic.emit<Tick>(0, 3);
+  CHECK_EQ(constructed, 1);
+  CHECK_EQ(h.log, std::vector<int>{2, 3});
+
+  CHECK_EQ(ic.disconnect<&Handler::onTrace>(h), 1);
+  ic.emit<TraceEvent>(constructed, 4);
+  CHECK_EQ(constructed, 1);
+
+  CHECK_EQ(ic.disconnect(h), 1);
+  CHECK_FALSE(ic.hasSubscribers<Trade>());
+  ic.connect<&Handler::onTick>(h, 7);
+  CHECK(ic.hasSubscribers<Trade>());
+  CHECK_EQ(ic.disconnect(h), 1);
+  CHECK_FALSE(ic.hasSubscribers<Tick>());
+}
+
+TEST_CASE("Hash based event dispatcher 4 disabled categories test ")
+{
+  struct Handler
+  {
+    std::vector<int> log;
+
+    void onTrace(const TraceTick& tick)
+    {
+      log.push_back(tick.value);
+    }
+
+    void onDebug(const DebugTick& tick)
+    {
+      log.push_back(tick.value);
+    }
+  };
+
+  static_assert(!HB4::isCategoryEnabled<TraceTick>());
+  static_assert(HB4::isCategoryEnabled<DebugTick>());
+  static_assert(HB4::isCategoryEnabled<Tick>());
+
+  Handler h;
+  HB4::InvokerContainer ic;
+  ic.connect<&Handler::onTrace, &Handler::onDebug>(h);
+  auto connection = ic.connect([&h](const TraceTick&)
+                               {
+                                 h.log.push_back(-1);
+                               });
+  CHECK_FALSE(connection.isConnected());
+  CHECK_FALSE(ic.hasSubscribers<TraceTick>());
+  CHECK(ic.hasSubscribers<DebugTick>());
+
+  TraceTick trace;
+  trace.value = 1;
+  DebugTick debug;
+  debug.value = 2;
+  ic.invoke(trace);
+  ic.invoke(debug);
+  CHECK_EQ(h.log, std::vector<int>{2});
+}
+
+#ifdef HB4_PROFILE_HANDLERS
+TEST_CASE("Hash based event dispatcher 4 handler profiling test ")
+{
+  struct Handler
+  {
+    int calls = 0;
+
+    void onTick(const Tick&)
+    {
+      ++calls;
+    }
+  };
+
+  Handler h1;
+  Handler h2;
+  HB4::InvokerContainer ic;
+  ic.connect<&Handler::onTick>(h1);
+  ic.connect<&Handler::onTick>(h2);
+  HB4::resetProfile();
+  ic.invoke(Tick{});
+  ic.invoke(Tick{});
+  ic.disconnect(h2);
+  ic.invoke(Tick{});
+
+  const auto methodId = HB4::AddressTypeIds::methodId<&Handler::onTick>();
+  const auto find = [methodId](const void* object)
+  {
+    const auto profiles = HB4::profileSnapshot();
+    const auto it = std::find_if(begin(profiles), end(profiles),
+                                 [object, methodId](const auto& profile)
+                                 {
+                                   return profile.object == object &&
+                                          profile.methodId == methodId;
+                                 });
+    return it == end(profiles) ? std::optional<HB4::HandlerProfile>() : *it;
+  };
+  CHECK_EQ(find(&h1)->calls, 3);
+  CHECK_NE(find(&h1)->name.find("onTick"), std::string::npos);
+  CHECK_GE(find(&h1)->totalTicks, find(&h1)->maxTicks);
+  CHECK_NE(HB4::profileReport().find("onTick"), std::string::npos);
+
+  // запись отключенного обработчика освобождается: объект по тому же
+  // адресу начинает с нуля
+  CHECK_FALSE(find(&h2).has_value());
+  ic.connect<&Handler::onTick>(h2);
+  ic.invoke(Tick{});
+  CHECK_EQ(find(&h2)->calls, 1);
+  CHECK_EQ(find(&h1)->calls, 4);
+}
+#endif
+
+TEST_CASE("Hash based event dispatcher 4 latency histograms test ")
+{
+  struct Handler
+  {
+    void onTick(const Tick&)
+    {
+    }
+  };
+
+  static_assert(LatencyHistogram::bucketIndex(15) == 15);
+  static_assert(LatencyHistogram::bucketValue(LatencyHistogram::bucketIndex(1000)) <= 1000);
+  static_assert(LatencyHistogram::bucketIndex(~uint64_t(0)) < LatencyHistogram::bucketCount);
+
+  Handler h;
+  HB4::InvokerContainer ic1;
+  HB4::InvokerContainer ic2;
+  ic1.connect<&Handler::onTick>(h);
+  ic2.connect<&Handler::onTick>(h);
+  ic1.invoke(Tick{});
+  CHECK(ic1.getLatencyReport().eventTypes.empty());
+
+  ic1.setLatencyHistogramsEnabled(true, 1);
+  ic2.setLatencyHistogramsEnabled(true, 1);
+  for (int i = 0; i < 100; ++i)
+  {
+    ic1.invoke(Tick{});
+    ic2.invoke(Tick{});
+  }
+  const auto& latency = *ic1.getLatencyReport().eventTypes.at(
+          HB4::AddressTypeIds::typeId<Tick>());
+  CHECK_EQ(latency.dispatch.getCount(), 100);
+  CHECK_EQ(latency.rebuild.getCount(), 0);
+  CHECK_LE(latency.dispatch.percentile(0.5), latency.dispatch.percentile(0.99));
+  CHECK_LE(latency.dispatch.percentile(0.999), latency.dispatch.getMax());
+
+  HB4::LatencyReport total;
+  total.merge(ic1.getLatencyReport());
+  total.merge(ic2.getLatencyReport());
+  const auto& merged = *total.eventTypes.at(HB4::AddressTypeIds::typeId<Tick>());
+  // первая доставка ic2 перестраивала списки
+  CHECK_EQ(merged.dispatch.getCount(), 199);
+  CHECK_EQ(merged.rebuild.getCount(), 1);
+  total.get(HB4::AddressTypeIds::typeId<Trade>(), "quoted\"name");
+  const auto json = total.toJson();
+  CHECK_NE(json.find("Tick\":{\"dispatch\":{\"count\":199"), std::string::npos);
+  CHECK_NE(json.find("\"p999\":"), std::string::npos);
+  CHECK_NE(json.find("\"quoted\\\"name\":"), std::string::npos);
+
+  // выборка: замеряется одна доставка из 10, перестроения - все
+  HB4::InvokerContainer sampled;
+  sampled.connect<&Handler::onTick>(h);
+  sampled.setLatencyHistogramsEnabled(true, 10);
+  for (int i = 0; i < 100; ++i)
+  {
+    sampled.invoke(Tick{});
+  }
+  const auto& sampledLatency = *sampled.getLatencyReport().eventTypes.at(
+          HB4::AddressTypeIds::typeId<Tick>());
+  CHECK_EQ(sampledLatency.rebuild.getCount(), 1);
+  CHECK_EQ(sampledLatency.dispatch.getCount(), 10);
+
+  // у каждого потока своя гистограмма, сводная собирается при чтении
+  std::array<LatencyHistogram, 4> perThread;
+  std::vector<std::thread> writers;
+  for (uint64_t t = 1; t <= perThread.size(); ++t)
+  {
+    writers.emplace_back([&histogram = perThread[t - 1], t]()
+                         {
+                           for (int i = 0; i < 10000; ++i)
+                           {
+                             histogram.record(t * 100);
+                           }
+                         });
+  }
+  for (auto& writer: writers)
+  {
+    writer.join();
+  }
+  LatencyHistogram combined;
+  for (const auto& histogram: perThread)
+  {
+    combined.merge(histogram);
+  }
+  CHECK_EQ(combined.getCount(), 40000);
+  CHECK_EQ(combined.getMax(), 400);
+}
+
+TEST_CASE("Hash based event dispatcher 4 structure stats test ")
+{
+  struct Handler
+  {
+    void onTick(const Tick&)
+    {
+    }
+
+    void onTrade(const Trade&)
+    {
+    }
+  };
+
+  Handler h1;
+  Handler h2;
+  Handler h3;
+  HB4::InvokerContainer ic;
+  ic.connect<&Handler::onTick, &Handler::onTrade>(h1);
+  ic.connect<&Handler::onTick>(h2);
+  const auto& stats = ic.getStructureStats();
+  CHECK_EQ(stats.makeInvokersTree.count, 3);
+  CHECK_EQ(stats.updateDependencies.count, 3);
+  // Tick с производным Trade
+  CHECK_EQ(stats.updateDependencies.maxInput, 2);
+  CHECK_EQ(stats.updateSimpleInvokers.count, 0);
+
+  ic.invoke(Trade{});
+  CHECK_EQ(stats.updateSimpleInvokers.count, 1);
+  CHECK_EQ(stats.updateSimpleInvokers.totalInput, 2);
+  CHECK_EQ(stats.applyPendingChanges.count, 0);
+
+  ic.connect<&Handler::onTick>(h3);
+  ic.invoke(Tick{});
+  CHECK_EQ(stats.updateSimpleInvokers.count, 1);
+  CHECK_EQ(stats.applyPendingChanges.count, 1);
+  CHECK_EQ(stats.applyPendingChanges.totalInput, 1);
+
+  ic.disconnect(h2);
+  CHECK_GE(stats.compaction.count, 2);
+  CHECK_GE(stats.compaction.maxInput, 3);
+  CHECK_EQ(stats.removeEmpty.count, 1);
+  CHECK_LE(stats.compaction.meanNs(), static_cast<double>(stats.compaction.maxNs));
+
+  ic.resetStructureStats();
+  CHECK_EQ(stats.compaction.count, 0);
+  CHECK_EQ(stats.makeInvokersTree.totalInput, 0);
+}
+
+TEST_CASE("Hash based event dispatcher 3 structure stats test ")
+{
+  struct Handler
+  {
+    void onTick(const Tick&)
+    {
+    }
+
+    void onTrade(const Trade&)
+    {
+    }
+  };
+
+  Handler h1;
+  Handler h2;
+  HB3::InvokerContainer ic;
+  ic.connect<&Handler::onTick, &Handler::onTrade>(h1);
+  ic.connect<&Handler::onTick>(h2);
+  const auto& stats = ic.getStructureStats();
+  CHECK_EQ(stats.makeInvokersTree.count, 3);
+  CHECK_EQ(stats.updateDependencies.count, 3);
+  // Tick с производным Trade
+  CHECK_EQ(stats.updateDependencies.maxInput, 2);
+  CHECK_EQ(stats.updateSimpleInvokers.count, 0);
+
+  CHECK_EQ(ic.disconnect<&Handler::onTick>(h2), 1);
+  CHECK_GE(stats.compaction.count, 1);
+  CHECK_EQ(stats.removeEmpty.count, 1);
+  if constexpr (StructureStats::timed)
+  {
+    CHECK_LE(stats.makeInvokersTree.maxNs, stats.makeInvokersTree.totalNs);
+  }
+  else
+  {
+    CHECK_EQ(stats.makeInvokersTree.totalNs, 0);
+  }
+
+  ic.resetStructureStats();
+  CHECK_EQ(stats.compaction.count, 0);
+  CHECK_EQ(stats.updateDependencies.totalInput, 0);
+}
+
+TEST_CASE("Hash based event dispatcher 4 incremental append test ")
+{
+  struct Other
+  {
+  };
+
+  struct Handler
+  {
+    std::vector<int>* log;
+    int id;
+
+    void onTick(const Tick&)
+    {
+      log->push_back(id);
+    }
+
+    void onOther(const Other&)
+    {
+    }
+  };
+
+  std::vector<int> log;
+  Handler h1{&log, 1};
+  Handler h2{&log, 2};
+  Handler h3{&log, 3};
+  Handler h4{&log, 4};
+  Handler h5{&log, 5};
+  Handler other{&log, 0};
+  HB4::InvokerContainer ic;
+  const auto& stats = ic.getStructureStats();
+  ic.connect<&Handler::onTick>(h1);
+  ic.connect<&Handler::onOther>(other, HB4::Priority{1});
+  ic.invoke(Tick{});
+
+  // приоритет обработчика другого типа не мешает дописыванию
+  ic.connect<&Handler::onTick>(h2);
+  log.clear();
+  ic.invoke(Tick{});
+  CHECK_EQ(log, std::vector<int>{1, 2});
+  CHECK_EQ(stats.applyPendingChanges.count, 1);
+  CHECK_EQ(stats.rebuildStale.count, 0);
+
+  // пока в списке есть обработчик с приоритетом, список перестраивается
+  ic.connect<&Handler::onTick>(h4, HB4::Priority{-1});
+  ic.invoke(Tick{});
+  ic.connect<&Handler::onTick>(h3);
+  log.clear();
+  ic.invoke(Tick{});
+  CHECK_EQ(log, std::vector<int>{1, 2, 3, 4});
+  CHECK_EQ(stats.rebuildStale.count, 2);
+
+  // после его отключения снова дописывается
+  CHECK_EQ(ic.disconnect(h4), 1);
+  ic.connect<&Handler::onTick>(h5);
+  log.clear();
+  ic.invoke(Tick{});
+  CHECK_EQ(log, std::vector<int>{1, 2, 3, 5});
+  CHECK_EQ(stats.rebuildStale.count, 2);
+}
+
+TEST_CASE("Hash based event dispatcher 4 hidden handlers test ")
+{
+  struct Handler
+  {
+    std::vector<int>* log;
+    int id;
+
+    void onTick(const Tick&)
+    {
+      log->push_back(id);
+    }
+
+    void onTrade(const Trade&)
+    {
+      log->push_back(id * 10);
+    }
+
+    void onDeepTick(const DeepTick<0>&)
+    {
+      log->push_back(id * 100);
+    }
+  };
+
+  // базовый тип подключается последним: в дереве типов объекта он
+  // забирает все производные узлы, а не только первый
+  std::vector<int> log;
+  Handler h1{&log, 1};
+  Handler h2{&log, 2};
+  HB4::InvokerContainer ic;
+  ic.connect<&Handler::onTick>(h1);
+  ic.connect<&Handler::onTrade, &Handler::onDeepTick, &Handler::onTick>(h2);
+  ic.invoke(Trade{});
+  CHECK_EQ(log, std::vector<int>{1, 20});
+  log.clear();
+  ic.invoke(DeepTick<0>{});
+  CHECK_EQ(log, std::vector<int>{1, 200});
+  log.clear();
+  ic.invoke(Tick{});
+  CHECK_EQ(log, std::vector<int>{1, 2});
+}
+
+#ifdef HB4_TRACE_DISPATCH
+TEST_CASE("Hash based event dispatcher 4 dispatch trace test ")
+{
+  struct Handler
+  {
+    void onTick(const Tick&)
+    {
+    }
+  };
+
+  const auto count = [](const std::string& json, const std::string& what)
+  {
+    size_t n = 0;
+    for (auto pos = json.find(what); pos != std::string::npos;
+         pos = json.find(what, pos + 1))
+    {
+      ++n;
+    }
+    return n;
+  };
+
+  Handler h;
+  HB4::InvokerContainer ic;
+  ic.connect<&Handler::onTick>(h);
+  HB4::flushTraceJson();
+  ic.invoke(Tick{});
+  CHECK_EQ(count(HB4::flushTraceJson(), "\"ph\""), 0);
+
+  HB4::setTraceSampling(2);
+  for (int i = 0; i < 4; ++i)
+  {
+    ic.invoke(Tick{});
+  }
+  // доставки из другого потока пишутся в его буфер
+  std::thread([&h]()
+              {
+                HB4::InvokerContainer threadIc;
+                threadIc.connect<&Handler::onTick>(h);
+                threadIc.invoke(Tick{});
+                threadIc.invoke(Tick{});
+              }).join();
+  HB4::setTraceSampling(0);
+
+  const auto json = HB4::flushTraceJson();
+  CHECK_EQ(json.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 0), 0);
+  // 3 доставки из выборки: начало и конец доставки и обработчика
+  CHECK_EQ(count(json, "\"ph\":\"B\""), 6);
+  CHECK_EQ(count(json, "\"ph\":\"E\""), 6);
+  CHECK_EQ(count(json, "\"cat\":\"handler\""), 6);
+  CHECK_NE(json.find("Tick\",\"cat\":\"dispatch\""), std::string::npos);
+  CHECK_NE(json.find("onTick\",\"cat\":\"handler\""), std::string::npos);
+  CHECK_NE(count(json, "\"tid\":"), count(json, "\"tid\":1}"));
+  CHECK_EQ(count(HB4::flushTraceJson(), "\"ph\""), 0);
+
+  // сброшенный буфер завершившегося потока достается следующему потоку
+  HB4::setTraceSampling(1);
+  std::thread([&h]()
+              {
+                HB4::InvokerContainer threadIc;
+                threadIc.connect<&Handler::onTick>(h);
+                threadIc.invoke(Tick{});
+              }).join();
+  HB4::setTraceSampling(0);
+  CHECK_EQ(count(HB4::flushTraceJson(), "\"ph\":\"B\""), 2);
+}
+#endif
+
+TEST_CASE("Hash based event dispatcher 4 steady state allocations test ")
+{
+  struct Handler
+  {
+    int sum = 0;
+
+    void onTick(const Tick& tick)
+    {
+      sum += tick.value;
+    }
+
+    void onTrade(const Trade& trade)
+    {
+      sum += trade.value;
+    }
+
+    int onQuery(const Tick& tick)
+    {
+      return tick.value;
+    }
+  };
+
+  std::vector<Handler> handlers(8);
+  HB4::InvokerContainer ic;
+  {
+    AllocationScope connects;
+    ic.connect<&Handler::onTick, &Handler::onTrade>(handlers[0]);
+    ic.connect<&Handler::onTick>(handlers[1], HB4::Group{1});
+    ic.connect<&Handler::onTick>(handlers[2], 1);
+    ic.connect<&Handler::onTick>(handlers[3], HB4::Filter<&Tick::value>{HB4::FilterOp::Greater, 5});
+    ic.connect<&Handler::onQuery>(handlers[4]);
+    CHECK_GT(connects.count(), 0);
+  }
+  Trade trade;
+  trade.value = 7;
+  // первая доставка строит списки
+  ic.invoke(Tick{1, 10});
+  ic.invoke(trade);
+  HB4::Sum<int> sum;
+  ic.invoke(Tick{1, 10}, sum);
+  // счетчик подписчиков заводится при первом запросе
+  CHECK(ic.hasSubscribers<Tick>());
+
+  AllocationScope invokes;
+  for (int i = 0; i < 100; ++i)
+  {
+    ic.invoke(Tick{1, i});
+    ic.invoke(Tick{2, i});
+    ic.invoke(trade);
+    ic.invoke(Tick{1, i}, sum);
+    CHECK(ic.hasSubscribers<Tick>());
+  }
+  ic.setGroupEnabled(HB4::Group{1}, false);
+  ic.invoke(Tick{1, 10});
+  CHECK_EQ(invokes.count(), 0);
+  CHECK_GT(handlers[0].sum, 0);
+}
+
+TEST_CASE("Hash based event dispatcher 4 memory resource test ")
+{
+  struct Handler
+  {
+    int sum = 0;
+
+    void onTick(const Tick& tick)
+    {
+      sum += tick.value;
+    }
+
+    void onTrade(const Trade& trade)
+    {
+      sum += trade.value;
+    }
+  };
+
+  struct CountingResource : std::pmr::memory_resource
+  {
+    explicit CountingResource(std::pmr::memory_resource* i_upstream)
+            : upstream(i_upstream)
+    {
+    }
+
+    void* do_allocate(const size_t i_bytes, const size_t i_alignment) override
+    {
+      ++allocations;
+      return upstream->allocate(i_bytes, i_alignment);
+    }
+
+    void do_deallocate(void* i_p, const size_t i_bytes,
+                       const size_t i_alignment) override
+    {
+      upstream->deallocate(i_p, i_bytes, i_alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& i_other) const noexcept override
+    {
+      return this == &i_other;
+    }
+
+    std::pmr::memory_resource* upstream;
+    size_t allocations = 0;
+  };
+
+  static std::array<std::byte, 1 << 16> buffer;
+  std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size(),
+                                            std::pmr::null_memory_resource());
+  std::pmr::unsynchronized_pool_resource pool(&arena);
+  CountingResource resource(&pool);
+
+  std::vector<Handler> handlers(3);
+  HB4::InvokerContainer ic(&resource);
+  // таблицы, списки доставки и временные деревья не берут память из кучи
+  AllocationScope heap;
+  ic.connect<&Handler::onTick, &Handler::onTrade>(handlers[0]);
+  ic.connect<&Handler::onTick>(handlers[1]);
+  ic.connect<&Handler::onTrade>(handlers[2]);
+  // ограничения порядка и временные таблицы сортировки - тоже
+  ic.addOrdering<&Handler::onTrade, &Handler::onTrade>(handlers[2], handlers[0]);
+  Trade trade;
+  trade.value = 2;
+  ic.invoke(trade);
+  ic.invoke(Tick{1, 1});
+  CHECK_EQ(ic.disconnect(handlers[1]), 1);
+  ic.invoke(Tick{1, 1});
+#if !defined(HB4_PROFILE_HANDLERS) && !defined(HB4_TRACE_DISPATCH)
+  // записи профиля и имена трассы заводятся в общей куче
+  CHECK_EQ(heap.count(), 0);
+#endif
+  CHECK_GT(resource.allocations, 0);
+  CHECK_EQ(handlers[0].sum, 4);
+  CHECK_EQ(handlers[1].sum, 3);
+  CHECK_EQ(handlers[2].sum, 2);
+}
+
+namespace
+{
+  struct SmallTraits : HB4::FixedInvokerContainerTraits
+  {
+    static constexpr size_t maxEventTypes = 2;
+    static constexpr size_t maxHandlersPerType = 2;
+    static constexpr size_t maxHiddenTypes = 1;
+  };
+
+  struct WideTraits : SmallTraits
+  {
+    static constexpr size_t maxEventTypes = 4;
+  };
+}
+
+TEST_CASE("Hash based event dispatcher 4 fixed capacity container test ")
+{
+  struct Handler
+  {
+    std::vector<int>& log;
+    int id = 0;
+
+    void onTick(const Tick&)
+    {
+      log.push_back(id);
+    }
+
+    bool onTrade(const Trade& trade)
+    {
+      log.push_back(id * 10);
+      return trade.flags != 0;
+    }
+  };
+
+  std::vector<int> log;
+  log.reserve(16);
+  const std::vector<int> tradeLog{10, 2, 30};
+  const std::vector<int> consumedLog{10};
+  const std::vector<int> tickLog{1, 2};
+  const std::vector<int> unhiddenLog{1, 2, 30};
+  Handler h1{log, 1};
+  Handler h2{log, 2};
+  Handler h3{log, 3};
+  HB4::BasicFixedInvokerContainer<SmallTraits> ic;
+
+  // подключения, доставка и отключения не берут память из кучи
+  AllocationScope heap;
+  CHECK(ic.connect<&Handler::onTick, &Handler::onTrade>(h1) ==
+        HB4::FixedStatus::Ok);
+  CHECK(ic.connect<&Handler::onTick>(h2) == HB4::FixedStatus::Ok);
+  // третий обработчик Tick не помещается, Trade не подключается тоже
+  CHECK(ic.connect<&Handler::onTrade, &Handler::onTick>(h3) ==
+        HB4::FixedStatus::TooManyHandlers);
+  CHECK(ic.connect<&Handler::onTrade>(h3) == HB4::FixedStatus::Ok);
+  CHECK(ic.hasSubscribers<Trade>());
+
+  // порядок подключения по всем уровням, onTick объекта h1 скрыт onTrade
+  Trade trade;
+  CHECK_FALSE(ic.invoke(trade));
+  CHECK_EQ(log, tradeLog);
+  log.clear();
+
+  trade.flags = 1;
+  CHECK(ic.invoke(trade));
+  CHECK_EQ(log, consumedLog);
+  log.clear();
+
+  CHECK_FALSE(ic.invoke(Tick{}));
+  CHECK_EQ(log, tickLog);
+  log.clear();
+
+  // после отключения onTrade обработчик Tick объекта h1 получает Trade
+  CHECK_EQ(ic.disconnect<&Handler::onTrade>(h1), 1);
+  trade.flags = 0;
+  ic.invoke(trade);
+  CHECK_EQ(log, unhiddenLog);
+  log.clear();
+  CHECK_EQ(heap.count(), 0);
+
+  CHECK_EQ(ic.disconnect(h2), 1);
+  CHECK_EQ(ic.disconnect(h3), 1);
+  // Trade по-прежнему получает onTick объекта h1
+  CHECK(ic.hasSubscribers<Trade>());
+
+  struct DeepHandler
+  {
+    void onTick(const Tick&)
+    {
+    }
+
+    void onTrade(const Trade&)
+    {
+    }
+
+    void onQuote(const Quote&)
+    {
+    }
+  };
+
+  // типов событий уже два
+  DeepHandler deep;
+  CHECK(ic.connect<&Handler::onTrade>(h2) == HB4::FixedStatus::Ok);
+  CHECK(ic.connect<&DeepHandler::onQuote>(deep) ==
+        HB4::FixedStatus::TooManyEventTypes);
+
+  // onTick скрыт и Trade, и Quote
+  HB4::BasicFixedInvokerContainer<WideTraits> wide;
+  CHECK(wide.connect<&DeepHandler::onTick, &DeepHandler::onTrade,
+          &DeepHandler::onQuote>(deep) == HB4::FixedStatus::TooManyHiddenTypes);
+  CHECK_FALSE(wide.hasSubscribers<Tick>());
+  CHECK(wide.connect<&DeepHandler::onTrade, &DeepHandler::onQuote>(deep) ==
+        HB4::FixedStatus::Ok);
+
+  // отключение во время доставки
+  struct SelfDisconnecting
+  {
+    HB4::FixedInvokerContainer& ic;
+    int calls = 0;
+
+    void onTick(const Tick&)
+    {
+      ++calls;
+      CHECK_EQ(ic.disconnect(*this), 1);
+    }
+  };
+  HB4::FixedInvokerContainer fixed;
+  SelfDisconnecting first{fixed};
+  SelfDisconnecting second{fixed};
+  CHECK(fixed.connect<&SelfDisconnecting::onTick>(first) == HB4::FixedStatus::Ok);
+  CHECK(fixed.connect<&SelfDisconnecting::onTick>(second) == HB4::FixedStatus::Ok);
+  fixed.invoke(Tick{});
+  fixed.invoke(Tick{});
+  CHECK_EQ(first.calls, 1);
+  CHECK_EQ(second.calls, 1);
+  CHECK_FALSE(fixed.hasSubscribers<Tick>());
+
+  // слот удаленного типа достается новому типу пустым
+  HB4::FixedInvokerContainer reused;
+  CHECK(reused.connect<&DeepHandler::onQuote>(deep) == HB4::FixedStatus::Ok);
+  CHECK(reused.connect<&Handler::onTrade>(h2) == HB4::FixedStatus::Ok);
+  CHECK_EQ(reused.disconnect(deep), 1);
+  CHECK(reused.connect<&Handler::onTick>(h1) == HB4::FixedStatus::Ok);
+  reused.invoke(Tick{});
+  CHECK_EQ(log, std::vector<int>{1});
+  log.clear();
+  reused.invoke(trade);
+  CHECK_EQ(log, std::vector<int>{20, 1});
+  log.clear();
+}
+
+TEST_CASE("Hash based event dispatcher 4 compact container test ")
+{
+  struct Handler
+  {
+    std::vector<int>& log;
+    int id = 0;
+
+    void onTick(const Tick&)
+    {
+      log.push_back(id);
+    }
+
+    bool onTrade(const Trade& trade)
+    {
+      log.push_back(id * 10);
+      return trade.flags != 0;
+    }
+  };
+
+  std::vector<int> log;
+  Handler h1{log, 1};
+  Handler h2{log, 2};
+  Handler h3{log, 3};
+  HB4::CompactInvokerContainer ic;
+  ic.connect<&Handler::onTick, &Handler::onTrade>(h1);
+  ic.connect<&Handler::onTick>(h2);
+  ic.connect<&Handler::onTrade>(h3);
+  CHECK_EQ(ic.getHandlersCount(), 4);
+
+  // порядок подключения по всем уровням, onTick объекта h1 скрыт onTrade
+  Trade trade;
+  CHECK_FALSE(ic.invoke(trade));
+  CHECK_EQ(log, std::vector<int>{10, 2, 30});
+  log.clear();
+
+  trade.flags = 1;
+  CHECK(ic.invoke(trade));
+  CHECK_EQ(log, std::vector<int>{10});
+  log.clear();
+
+  ic.invoke(Tick{});
+  CHECK_EQ(log, std::vector<int>{1, 2});
+  log.clear();
+
+  CHECK_EQ(ic.disconnect<&Handler::onTrade>(h1), 1);
+  trade.flags = 0;
+  ic.invoke(trade);
+  CHECK_EQ(log, std::vector<int>{1, 2, 30});
+  log.clear();
+
+  // слот h2 достается h3, порядок подключения сохраняется
+  CHECK_EQ(ic.disconnect(h2), 1);
+  CHECK_EQ(ic.disconnect(h3), 1);
+  ic.connect<&Handler::onTick>(h3);
+  ic.invoke(Tick{});
+  CHECK_EQ(log, std::vector<int>{1, 3});
+  log.clear();
+  CHECK_EQ(ic.disconnect(h1), 1);
+  CHECK_EQ(ic.disconnect(h3), 1);
+  CHECK_FALSE(ic.hasSubscribers<Tick>());
+
+  // отключение во время доставки
+  struct SelfDisconnecting
+  {
+    HB4::CompactInvokerContainer& ic;
+    int calls = 0;
+
+    void onTick(const Tick&)
+    {
+      ++calls;
+      CHECK_EQ(ic.disconnect(*this), 1);
+    }
+  };
+  SelfDisconnecting first{ic};
+  SelfDisconnecting second{ic};
+  ic.connect<&SelfDisconnecting::onTick>(first);
+  ic.connect<&SelfDisconnecting::onTick>(second);
+  ic.invoke(Tick{});
+  ic.invoke(Tick{});
+  CHECK_EQ(first.calls, 1);
+  CHECK_EQ(second.calls, 1);
+
+  // номера подключений сжимаются после отключений, порядок уровней прежний
+  Handler h4{log, 4};
+  ic.connect<&Handler::onTick>(h1);
+  ic.connect<&Handler::onTrade>(h3);
+  for (int i = 0; i < 100; ++i)
+  {
+    ic.connect<&Handler::onTick>(h2);
+    CHECK_EQ(ic.disconnect(h2), 1);
+  }
+  ic.connect<&Handler::onTick>(h4);
+  ic.invoke(trade);
+  CHECK_EQ(log, std::vector<int>{1, 30, 4});
+  log.clear();
+
+  // глубже 16 уровней не подключается: подключение откатывается целиком,
+  // раньше подключенное остается, слот объекта не остается занятым
+  struct DeepHandler
+  {
+    void onTick(const DeepTick<14>&)
+    {
+    }
+
+    void onDeepTick(const DeepTick<15>&)
+    {
+    }
+  };
+  DeepHandler deep;
+  CHECK_THROWS_AS((ic.connect<&DeepHandler::onTick, &DeepHandler::onDeepTick>(deep)),
+                  std::length_error);
+  CHECK_EQ(ic.disconnect(deep), 0);
+  ic.connect<&DeepHandler::onTick>(deep);
+  CHECK_THROWS_AS((ic.connect<&DeepHandler::onTick, &DeepHandler::onDeepTick>(deep)),
+                  std::length_error);
+  CHECK_EQ(ic.disconnect(deep), 1);
+  CHECK_THROWS_AS(ic.connect<&DeepHandler::onDeepTick>(deep), std::length_error);
+  CHECK_EQ(ic.disconnect(deep), 0);
+  CHECK_EQ(ic.getHandlersCount(), 3);
+  ic.connect<&Handler::onTick>(h2);
+  ic.invoke(Tick{});
+  CHECK_EQ(log, std::vector<int>{1, 4, 2});
+  log.clear();
+
+  // запись доставки - 8 байт и 4 байта номера подключения, у объекта еще
+  // слот и узел индекса объектов
+  std::vector<Handler> many(1000, Handler{log, 0});
+  HB4::CompactInvokerContainer compact;
+  for (auto& handler: many)
+  {
+    compact.connect<&Handler::onTick>(handler);
+  }
+  compact.invoke(Tick{});
+  CHECK_EQ(log.size(), many.size());
+  CHECK_LT(compact.getMemoryUsage(), many.size() * 80);
+}
+
+TEST_CASE("Small vector test ")
+{
+  const std::array<int, 3> values{1, 2, 3};
+
+  AllocationScope heap;
+  SmallVector<int, 2> inlined;
+  inlined.assign(values.begin(), values.begin() + 2);
+  SmallVector<int, 2> copy(inlined);
+  SmallVector<int, 2> moved(std::move(copy));
+  CHECK_EQ(heap.count(), 0);
+  CHECK(moved.isInline());
+  CHECK_EQ(moved.size(), 2);
+  CHECK(copy.empty());
+  const ArrayView2<int> view = moved;
+  CHECK_EQ(view.size(), 2);
+  CHECK_EQ(view[1], 2);
+
+  // сверх N - в памяти распределителя, перенос забирает ее без копирования
+  std::array<std::byte, 256> buffer;
+  std::pmr::monotonic_buffer_resource resource(buffer.data(), buffer.size(),
+                                               std::pmr::null_memory_resource());
+  using PmrSmallVector = SmallVector<int, 2, std::pmr::polymorphic_allocator<int>>;
+  PmrSmallVector grown(&resource);
+  for (const auto value: values)
+  {
+    grown.push_back(value);
+  }
+  CHECK_FALSE(grown.isInline());
+  const auto* data = grown.data();
+  PmrSmallVector stolen(std::move(grown));
+  CHECK_EQ(stolen.data(), data);
+  CHECK_EQ(stolen[2], 3);
+  CHECK(grown.isInline());
+
+  PmrSmallVector other(stolen, &resource);
+  CHECK_NE(other.data(), data);
+  other.assign(values.begin(), values.begin() + 1);
+  CHECK_EQ(other.size(), 1);
+  CHECK_EQ(heap.count(), 0);
+}
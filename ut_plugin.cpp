@@ -0,0 +1,36 @@
+#include "ut_plugin.h"
+
+#define PLUGIN_EXPORT extern "C" __attribute__((visibility("default")))
+
+namespace
+{
+  struct PluginHandler
+  {
+    int* counter = nullptr;
+
+    void onEvent1(const PluginTest::PluginEvent1& event)
+    {
+      *counter += event.value;
+    }
+  };
+
+  PluginHandler handler;
+}
+
+PLUGIN_EXPORT void connectHandler(HB4::StableInvokerContainer& ic, int& counter)
+{
+  handler.counter = &counter;
+  ic.connect<&PluginHandler::onEvent1>(handler);
+}
+
+PLUGIN_EXPORT void invokeEvent(HB4::StableInvokerContainer& ic, int value)
+{
+  PluginTest::PluginEvent1 event;
+  event.value = value;
+  ic.invoke(event);
+}
+
+PLUGIN_EXPORT HB4::TypeId addressTypeId()
+{
+  return HB4::AddressTypeIds::typeId<PluginTest::PluginEvent1>();
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "HashBasedEventDispatcher4.h"
+
+// общие для ut и плагина ut_plugin типы событий и точки входа
+
+namespace PluginTest
+{
+  struct PluginEvent
+  {
+    int value = 0;
+  };
+
+  struct PluginEvent1 : PluginEvent
+  {
+    using Base = PluginEvent;
+  };
+
+  // подключает обработчик PluginEvent1, живущий в плагине, обработчик
+  // прибавляет value к counter
+  using ConnectHandler = void (*)(HB4::StableInvokerContainer& ic,
+                                  int& counter);
+  // отправляет PluginEvent1 из плагина
+  using InvokeEvent = void (*)(HB4::StableInvokerContainer& ic, int value);
+  // AddressTypeIds::typeId<PluginEvent1>() в плагине
+  using AddressTypeId = HB4::TypeId (*)();
+}